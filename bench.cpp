@@ -0,0 +1,909 @@
+#include "octree.h"
+#include "linear_octree.h"
+#include "dense_octree.h"
+#include "octree_grid.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <set>
+#include <random>
+#include <chrono>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace mymath;
+
+/*
+* Headless benchmark of octree build, update, query and remove
+* Needs nothing but the octree and mymath, so it can run on machines without a display
+*/
+
+typedef chrono::high_resolution_clock bench_clock;
+
+static double elapsed_ns( bench_clock::time_point start )
+{
+  return ( double )chrono::duration_cast<chrono::nanoseconds>( bench_clock::now() - start ).count();
+}
+
+//peak resident set size in kilobytes
+static size_t get_peak_rss()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+    return pmc.PeakWorkingSetSize / 1024;
+
+  return 0;
+#else
+  struct rusage usage;
+  if( !getrusage( RUSAGE_SELF, &usage ) )
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; //bytes on osx
+#else
+    return usage.ru_maxrss;
+#endif
+
+  return 0;
+#endif
+}
+
+static void report( const string& phase, size_t ops, double ns, const string& extra = "" )
+{
+  cout << "  " << phase << ": " << ops << " ops, "
+    << ( ops ? ns / ops : 0 ) << " ns/op, "
+    << ( ns > 0 ? ops / ( ns * 1e-9 ) : 0 ) << " ops/s"
+    << extra << endl;
+}
+
+struct scenario
+{
+  string distribution;
+  unsigned objects;
+  float move_ratio;
+  float speed; //units per frame
+  unsigned frames;
+  unsigned removes;
+  float world; //objects are placed in [0, world]^3
+  unsigned seed;
+  float margin; //fat bounds, see octree_settings
+  float lookahead;
+  bool split_static; //insert the objects that never move as static
+  unsigned budget; //nodes aged per update, see octree<t>::update
+  unsigned merge;
+  bool object_bounds;
+  bool tight_bounds;
+};
+
+static vec3 random_position( const scenario& s, mt19937& rng, const vector<vec3>& clusters )
+{
+  uniform_real_distribution<float> uniform( 0, s.world );
+
+  if( s.distribution == "clustered" )
+  {
+    uniform_int_distribution<size_t> pick( 0, clusters.size() - 1 );
+    normal_distribution<float> spread( 0, s.world / 50 );
+    const vec3& c = clusters[pick( rng )];
+    return clamp( c + vec3( spread( rng ), spread( rng ), spread( rng ) ), vec3( 0 ), vec3( s.world ) );
+  }
+  else if( s.distribution == "planar" )
+  {
+    return vec3( uniform( rng ), 0, uniform( rng ) );
+  }
+
+  return vec3( uniform( rng ), uniform( rng ), uniform( rng ) );
+}
+
+//the camera circles around the world looking at its center
+template< class tree >
+static double run_queries( tree* o, const scenario& s, size_t& culled_total, octree_query_stats& query_stats )
+{
+  frame<float> the_frame;
+  the_frame.set_perspective( radians( 45.0f ), 16.0f / 9.0f, 1.0f, s.world );
+
+  vector<unsigned> culled;
+  double query_ns = 0;
+  culled_total = 0;
+
+  for( unsigned f = 0; f < s.frames; ++f )
+  {
+    float angle = 2 * pi * f / ( s.frames ? s.frames : 1 );
+    vec3 center( s.world * 0.5f );
+
+    camera<float> cam;
+    cam.lookat( center + vec3( cos( angle ), 0.5f, sin( angle ) ) * s.world * 0.5f, center, vec3( 0, 1, 0 ) );
+
+    frustum fr;
+    fr.set_up( cam, the_frame );
+
+    culled.clear();
+    auto start = bench_clock::now();
+    o->get_culled_objects( culled, &fr, &query_stats );
+    query_ns += elapsed_ns( start );
+    culled_total += culled.size();
+  }
+
+  return query_ns;
+}
+
+static void report_query_stats( const scenario& s, const octree_query_stats& query_stats )
+{
+#ifdef OCTREE_QUERY_STATS
+  if( s.frames )
+  {
+    cout << "    per query: " << query_stats.nodes_visited / s.frames << " nodes visited, "
+      << query_stats.nodes_rejected / s.frames << " rejected, "
+      << query_stats.nodes_accepted_fully / s.frames << " accepted fully, "
+      << query_stats.nodes_accepted_partially / s.frames << " accepted partially, "
+      << query_stats.intersection_tests[frustum::get_class_idx()] / s.frames << " intersection tests, "
+      << query_stats.containment_tests[frustum::get_class_idx()] / s.frames << " containment tests, "
+      << query_stats.objects_rejected / s.frames << " objects rejected" << endl;
+  }
+#else
+  ( void )s;
+  ( void )query_stats;
+#endif
+}
+
+static void run( const scenario& s )
+{
+  cout << "scenario: " << s.distribution << ", objects: " << s.objects << ", move ratio: " << s.move_ratio
+    << ", frames: " << s.frames << ", world: " << s.world << ", margin: " << s.margin << ", lookahead: " << s.lookahead << ", static: " << s.split_static << ", budget: " << s.budget << ", merge: " << s.merge << ", object bounds: " << s.object_bounds << ", tight bounds: " << s.tight_bounds << endl;
+
+  mt19937 rng( s.seed );
+
+  vector<vec3> clusters;
+  for( int c = 0; c < 32; ++c )
+  {
+    uniform_real_distribution<float> uniform( 0, s.world );
+    clusters.push_back( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ) );
+  }
+
+  vector<aabb> bvs( s.objects );
+  vector<pair<unsigned, shape*> > objects( s.objects );
+  for( unsigned c = 0; c < s.objects; ++c )
+  {
+    bvs[c] = aabb( random_position( s, rng, clusters ), vec3( 1 ) );
+    objects[c] = make_pair( c, &bvs[c] );
+  }
+
+  octree_settings settings;
+  settings.fat_margin = s.margin;
+  settings.fat_lookahead = s.lookahead;
+  settings.merge_threshold = s.merge;
+  settings.object_bounds = s.object_bounds;
+  settings.tight_bounds = s.tight_bounds;
+
+  auto o = new octree<unsigned>( aabb( vec3( 0 ), vec3( 1 ) ) );
+  o->set_up_octree( &o, settings );
+
+  /*
+  * Build
+  */
+
+  //the first moving objects are the dynamic ones
+  unsigned moving = unsigned( s.objects * s.move_ratio );
+
+  auto start = bench_clock::now();
+  for( auto& c : objects )
+    o->insert( c.first, c.second, s.split_static && c.first >= moving );
+  report( "build", objects.size(), elapsed_ns( start ) );
+
+  /*
+  * Update, a fixed set of dynamic objects moves with constant velocity and bounces off the world bounds
+  */
+
+  vector<vec3> velocities( moving );
+  for( auto& v : velocities )
+  {
+    uniform_real_distribution<float> dir( -1, 1 );
+    v = normalize( vec3( dir( rng ), s.distribution == "planar" ? 0 : dir( rng ), dir( rng ) ) + vec3( 0.001f ) ) * s.speed;
+  }
+
+  for( unsigned c = 0; c < moving; ++c )
+    o->set_velocity( objects[c].first, velocities[c] );
+
+  double update_ns = 0, worst_update_ns = 0;
+  size_t reinserted = 0;
+  for( unsigned f = 0; f < s.frames; ++f )
+  {
+    for( unsigned c = 0; c < moving; ++c )
+    {
+      vec3 pos = bvs[c].get_pos() + velocities[c];
+
+      bool bounced = false;
+      for( int i = 0; i < 3; ++i )
+        if( pos[i] < 0 || pos[i] > s.world )
+        {
+          velocities[c][i] = -velocities[c][i];
+          bounced = true;
+        }
+
+      if( bounced )
+        o->set_velocity( objects[c].first, velocities[c] );
+
+      bvs[c] = aabb( clamp( pos, vec3( 0 ), vec3( s.world ) ), vec3( 1 ) );
+    }
+
+    start = bench_clock::now();
+    for( unsigned c = 0; c < moving; ++c )
+      o->mark_dirty( objects[c].first );
+    reinserted += o->update( s.budget ).reinserted;
+    double ns = elapsed_ns( start );
+    update_ns += ns;
+    worst_update_ns = max( worst_update_ns, ns );
+  }
+
+  {
+    stringstream ss;
+    ss << ", " << ( s.frames ? update_ns / s.frames / 1e6 : 0 ) << " ms/frame, " << moving << " moving objects, "
+      << ( s.frames ? reinserted / s.frames : 0 ) << " reinsertions/frame, worst frame: " << worst_update_ns / 1e6 << " ms";
+    report( "update", size_t( moving ) * s.frames, update_ns, ss.str() );
+  }
+
+  /*
+  * Query
+  */
+
+  size_t culled_total = 0;
+  octree_query_stats query_stats;
+  double query_ns = run_queries( o, s, culled_total, query_stats );
+
+  {
+    stringstream ss;
+    ss << ", " << ( s.frames ? culled_total / s.frames : 0 ) << " objects/query";
+    report( "query", s.frames, query_ns, ss.str() );
+  }
+
+  report_query_stats( s, query_stats );
+
+  /*
+  * Linear octree, built from the same positions and queried with the same cameras
+  */
+
+  {
+    auto l = new linear_octree<unsigned>( aabb( vec3( s.world * 0.5f ), vec3( s.world * 0.5f + 1 ) ) );
+
+    start = bench_clock::now();
+    for( auto& c : objects )
+      l->insert( c.first, c.second );
+    report( "linear build", objects.size(), elapsed_ns( start ) );
+
+    octree_query_stats linear_stats;
+    query_ns = run_queries( l, s, culled_total, linear_stats );
+
+    {
+      stringstream ss;
+      ss << ", " << ( s.frames ? culled_total / s.frames : 0 ) << " objects/query";
+      report( "linear query", s.frames, query_ns, ss.str() );
+    }
+
+    report_query_stats( s, linear_stats );
+
+    octree_stats st = o->stats();
+    cout << "  memory: pointer " << st.node_count << " nodes, " << ( st.node_bytes + st.object_bytes ) / 1024 << " KB, linear "
+      << l->get_node_count() << " nodes, " << l->get_memory_bytes() / 1024 << " KB" << endl;
+
+    delete l;
+  }
+
+  /*
+  * Dense octree of a fixed depth, as used for static scenes
+  */
+
+  {
+    auto d = new dense_octree<unsigned, 6>( aabb( vec3( s.world * 0.5f ), vec3( s.world * 0.5f + 1 ) ) );
+
+    start = bench_clock::now();
+    d->build( objects );
+    report( "dense build", objects.size(), elapsed_ns( start ) );
+
+    octree_query_stats dense_stats;
+    query_ns = run_queries( d, s, culled_total, dense_stats );
+
+    {
+      stringstream ss;
+      ss << ", " << ( s.frames ? culled_total / s.frames : 0 ) << " objects/query, " << d->get_memory_bytes() / 1024 << " KB";
+      report( "dense query", s.frames, query_ns, ss.str() );
+    }
+
+    report_query_stats( s, dense_stats );
+
+    delete d;
+  }
+
+  /*
+  * Remove
+  */
+
+  unsigned removes = min( s.removes, s.objects );
+  start = bench_clock::now();
+  for( unsigned c = 0; c < removes; ++c )
+    o->remove( objects[s.objects - 1 - c].first );
+  report( "remove", removes, elapsed_ns( start ) );
+
+  //age the nodes the removes emptied until they all died
+  unsigned drain_frames = 0, merges = 0;
+  double drain_ns = 0, worst_drain_ns = 0;
+  octree_update_stats us;
+  do
+  {
+    start = bench_clock::now();
+    us = o->update( s.budget );
+    merges += us.merges;
+    double ns = elapsed_ns( start );
+    drain_ns += ns;
+    worst_drain_ns = max( worst_drain_ns, ns );
+    ++drain_frames;
+  }
+  while( us.nodes_pending && drain_frames < 100000 );
+
+  {
+    stringstream ss;
+    octree_stats st = o->stats();
+    ss << ", worst frame: " << worst_drain_ns / 1e6 << " ms, " << merges << " merges, "
+      << st.node_count << " nodes left, depth: " << st.depth;
+    report( "drain", drain_frames, drain_ns, ss.str() );
+  }
+
+  cout << "  peak rss: " << get_peak_rss() << " KB" << endl;
+
+  //the next scenario starts from a clean heap
+  octree<unsigned>::destroy( &o );
+}
+
+/*
+* Checks, run by --verify instead of the benchmark
+* queries are compared with brute force tests of the same objects, so an option that loses objects fails here
+*/
+
+struct churn_result
+{
+  size_t returned; //objects returned by the queries
+  size_t exact; //objects that really intersect the queries
+  unsigned misses; //intersecting objects that weren't returned, or that is_in_frustum didn't find
+  unsigned errors; //objects returned twice, or after they were removed, or that get_visibility disagrees about
+  size_t reinserted;
+  unsigned nodes; //left once the churn is over
+};
+
+//moves, removes and reinserts objects for a number of frames, then compares box, sphere and frustum queries with brute force
+//objects inserted after the last update are included, so the state between updates is checked too
+static churn_result verify_churn( const octree_settings& settings, unsigned seed )
+{
+  const unsigned count = 20000, late = 500, frames = 200, queries = 60;
+  const float world = 500;
+
+  mt19937 rng( seed );
+  uniform_real_distribution<float> uniform( 0, world ), step( -8, 8 );
+
+  vector<aabb> bvs( count + late );
+  vector<bool> removed( count + late, false );
+
+  auto o = new octree<unsigned>( aabb( vec3( 0 ), vec3( 1 ) ) );
+  o->set_up_octree( &o, settings );
+
+  //every other object is static, they are moved all the same
+  for( unsigned c = 0; c < count; ++c )
+  {
+    bvs[c] = aabb( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( float( 1 + c % 3 ) ) );
+    o->insert( c, &bvs[c], c % 2 == 0 );
+  }
+
+  churn_result r = {};
+
+  for( unsigned f = 0; f < frames; ++f )
+  {
+    for( unsigned c = 0; c < count / 10; ++c )
+    {
+      unsigned i = rng() % count;
+      vec3 velocity( step( rng ), step( rng ), step( rng ) );
+      vec3 pos = bvs[i].get_pos() + velocity;
+
+      //now and then everything jumps away from the origin, which grows the root
+      if( f % 50 == 49 )
+        pos = pos * 3.0f;
+
+      bvs[i] = aabb( pos, vec3( 1 ) );
+      o->set_velocity( i, velocity );
+      o->mark_dirty( i );
+    }
+
+    //removed objects come back a few frames later
+    if( f % 5 == 0 )
+      for( unsigned c = 0; c < 200; ++c )
+      {
+        unsigned i = rng() % count;
+
+        if( removed[i] )
+          o->insert( i, &bvs[i] );
+        else
+          o->remove( i );
+
+        removed[i] = !removed[i];
+      }
+
+    r.reinserted += o->update().reinserted;
+  }
+
+  r.nodes = o->stats().node_count;
+
+  for( unsigned c = count; c < count + late; ++c )
+  {
+    bvs[c] = aabb( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( 2 ) );
+    o->insert( c, &bvs[c] );
+  }
+
+  frame<float> the_frame;
+  the_frame.set_perspective( radians( 45.0f ), 16.0f / 9.0f, 1.0f, 300 );
+
+  vector<unsigned> objs;
+  vector<bool> found, visible;
+
+  for( unsigned q = 0; q < queries; ++q )
+  {
+    aabb box( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( 60 ) );
+    sphere ball( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), 50 );
+
+    camera<float> cam;
+    vec3 eye( uniform( rng ), uniform( rng ), uniform( rng ) );
+    cam.lookat( eye, vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( 0, 1, 0 ) );
+
+    frustum fr;
+    fr.set_up( cam, the_frame );
+
+    shape* query = q % 3 == 0 ? ( shape* )&box : q % 3 == 1 ? ( shape* )&ball : ( shape* )&fr;
+
+    objs.clear();
+    o->get_culled_objects( objs, query );
+    r.returned += objs.size();
+
+    found.assign( bvs.size(), false );
+    for( auto& c : objs )
+    {
+      if( c >= bvs.size() || removed[c] || found[c] )
+        ++r.errors;
+      else
+        found[c] = true;
+    }
+
+    o->get_visibility( visible, query );
+    visible.resize( bvs.size() );
+
+    for( unsigned c = 0; c < bvs.size(); ++c )
+      if( visible[c] != found[c] )
+        ++r.errors;
+
+    for( unsigned c = 0; c < bvs.size(); ++c )
+      if( !removed[c] && bvs[c].is_intersecting( query ) )
+      {
+        ++r.exact;
+
+        if( !found[c] || !o->is_in_frustum( c, query ) )
+          ++r.misses;
+      }
+  }
+
+  octree<unsigned>::destroy( &o );
+
+  return r;
+}
+
+static bool report_check( const string& name, const churn_result& r )
+{
+  bool ok = !r.misses && !r.errors;
+
+  cout << "  " << name << ": " << ( ok ? "ok" : "FAILED" ) << ", " << r.returned << " returned, " << r.exact << " exact, "
+    << r.misses << " missed, " << r.errors << " wrong, " << r.reinserted << " reinserted, " << r.nodes << " nodes" << endl;
+
+  return ok;
+}
+
+//moves objects and trigger spheres, and removes both, for a number of frames
+//after every update the contacts the events add up to are compared with brute force overlap tests,
+//and every event has to be consistent with them, returns the number of frames and events that weren't
+static unsigned verify_triggers( unsigned seed, size_t& event_count )
+{
+  typedef octree_trigger_event<unsigned> event;
+
+  const unsigned count = 5000, triggers = 40, frames = 300, first_trigger = 100000;
+  const float world = 1000;
+
+  mt19937 rng( seed );
+  uniform_real_distribution<float> uniform( 0, world ), step( -10, 10 );
+
+  vector<aabb> bvs( count );
+  vector<bool> removed( count, false );
+  vector<sphere> volumes( triggers );
+  vector<bool> is_trigger( triggers, false );
+
+  auto o = new octree<unsigned>( aabb( vec3( 0 ), vec3( 1 ) ) );
+  o->set_up_octree( &o );
+
+  for( unsigned c = 0; c < count; ++c )
+  {
+    bvs[c] = aabb( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( 2 ) );
+    o->insert( c, &bvs[c], c % 5 == 0 );
+  }
+
+  o->update();
+
+  set<pair<unsigned, unsigned> > contacts, seen, exact;
+  unsigned failures = 0;
+  event_count = 0;
+
+  for( unsigned f = 0; f < frames; ++f )
+  {
+    //a trigger is added every frame at first
+    if( f < triggers )
+    {
+      volumes[f] = sphere( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), 40 + uniform( rng ) * 0.05f );
+      o->insert_trigger( first_trigger + f, &volumes[f] );
+      is_trigger[f] = true;
+    }
+
+    for( unsigned c = 0; c < 100; ++c )
+    {
+      unsigned i = rng() % count;
+
+      if( !removed[i] && i % 5 )
+      {
+        bvs[i] = aabb( bvs[i].get_pos() + vec3( step( rng ), step( rng ), step( rng ) ), vec3( 2 ) );
+        o->mark_dirty( i, &bvs[i] );
+      }
+    }
+
+    unsigned j = rng() % triggers;
+
+    if( f % 3 == 0 && is_trigger[j] )
+    {
+      volumes[j] = sphere( volumes[j].get_center() + vec3( step( rng ), 0, step( rng ) ), volumes[j].get_radius() );
+      o->reposition_trigger( first_trigger + j, &volumes[j] );
+    }
+
+    if( f % 17 == 0 && is_trigger[j] )
+    {
+      o->remove_trigger( first_trigger + j );
+      is_trigger[j] = false;
+    }
+
+    if( f % 5 == 0 )
+    {
+      unsigned i = rng() % count;
+
+      if( removed[i] )
+        o->insert( i, &bvs[i] );
+      else
+        o->remove( i );
+
+      removed[i] = !removed[i];
+    }
+
+    o->update();
+
+    const vector<event>& events = o->get_trigger_events();
+    event_count += events.size();
+    seen.clear();
+
+    for( auto& e : events )
+    {
+      pair<unsigned, unsigned> p( e.trigger, e.object );
+      bool ok = seen.insert( p ).second; //one event per pair
+
+      if( e.type == event::enter )
+        ok = contacts.insert( p ).second && ok;
+      else if( e.type == event::exit )
+        ok = contacts.erase( p ) && ok;
+      else
+        ok = contacts.count( p ) && ok;
+
+      if( !ok )
+        ++failures;
+    }
+
+    exact.clear();
+    for( unsigned t = 0; t < triggers; ++t )
+      if( is_trigger[t] )
+        for( unsigned c = 0; c < count; ++c )
+          if( !removed[c] && bvs[c].is_intersecting( &volumes[t] ) )
+            exact.insert( make_pair( first_trigger + t, c ) );
+
+    if( exact != contacts )
+      ++failures;
+  }
+
+  octree<unsigned>::destroy( &o );
+
+  return failures;
+}
+
+//returns false if any check failed
+//objects wander across sectors and are removed and reinserted, queries are compared with brute force every frame
+//returns the objects missed or wrongly returned, sectors receives the sectors left once every object is removed
+static unsigned verify_grid( unsigned seed, unsigned& sectors )
+{
+  const unsigned count = 5000, frames = 100;
+  const float world = 1000;
+
+  mt19937 rng( seed );
+  uniform_real_distribution<float> uniform( -world, world ), step( -40, 40 );
+
+  vector<aabb> bvs( count );
+  vector<bool> removed( count, false ), found;
+  vector<unsigned> objs;
+  unsigned failures = 0;
+
+  octree_grid<unsigned> g( 128 );
+
+  for( unsigned c = 0; c < count; ++c )
+  {
+    bvs[c] = aabb( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), vec3( 2 ) );
+    g.insert( c, &bvs[c], c % 5 == 0 );
+  }
+
+  for( unsigned f = 0; f < frames; ++f )
+  {
+    for( unsigned c = 0; c < 500; ++c )
+    {
+      unsigned i = rng() % count;
+
+      if( !removed[i] )
+      {
+        bvs[i] = aabb( bvs[i].get_pos() + vec3( step( rng ), step( rng ), step( rng ) ), vec3( 2 ) );
+        g.mark_dirty( i, &bvs[i] );
+      }
+    }
+
+    for( unsigned c = 0; c < 50; ++c )
+    {
+      unsigned i = rng() % count;
+
+      if( removed[i] )
+        g.insert( i, &bvs[i] );
+      else
+        g.remove( i );
+
+      removed[i] = !removed[i];
+    }
+
+    g.update();
+
+    sphere ball( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), 200 );
+
+    objs.clear();
+    g.get_culled_objects( objs, &ball );
+
+    found.assign( count, false );
+    for( auto& c : objs )
+    {
+      if( c >= count || removed[c] || found[c] )
+        ++failures;
+      else
+        found[c] = true;
+    }
+
+    for( unsigned c = 0; c < count; ++c )
+      if( !removed[c] && bvs[c].is_intersecting( &ball ) && ( !found[c] || !g.is_in_frustum( c, &ball ) ) )
+        ++failures;
+  }
+
+  for( unsigned c = 0; c < count; ++c )
+    if( !removed[c] )
+      g.remove( c );
+
+  sectors = g.get_sector_count();
+
+  return failures;
+}
+
+//objects gathered in a corner of a world sized up front, then thinned out until the root is empty
+//returns the extent of the root afterwards, which has to still be the world
+static float verify_world_bounds()
+{
+  aabb world;
+  world.min = vec3( 0 );
+  world.max = vec3( 1000 );
+
+  auto o = new octree<unsigned>( aabb( vec3( 0 ), vec3( 1 ) ) );
+  o->set_up_octree( &o );
+  o->set_world_bounds( world );
+
+  vector<aabb> bvs( 50 );
+  for( unsigned c = 0; c < bvs.size(); ++c )
+  {
+    bvs[c] = aabb( vec3( 2 + c * 0.1f ), vec3( 0.5f ) );
+    o->insert( c, &bvs[c] );
+  }
+
+  for( unsigned c = 0; c < 30; ++c )
+    o->remove( c );
+
+  for( int c = 0; c < 20; ++c )
+    o->update();
+
+  vector<aabb> boxes;
+  o->get_boxes( boxes );
+
+  float extent = 0;
+  for( auto& b : boxes )
+    extent = max( extent, b.max.x - b.min.x );
+
+  octree<unsigned>::destroy( &o );
+
+  return extent;
+}
+
+static bool verify( const scenario& s )
+{
+  cout << "verify, seed: " << s.seed << endl;
+
+  bool ok = true;
+  octree_settings settings;
+
+  ok = report_check( "dirty updates", verify_churn( settings, s.seed ) ) && ok;
+
+  //the same moves, reinserted less often
+  settings.fat_margin = 4;
+  settings.fat_lookahead = 1;
+  ok = report_check( "fat bounds", verify_churn( settings, s.seed ) ) && ok;
+  settings = octree_settings();
+
+  //removals leave sparse subtrees behind to merge
+  settings.merge_threshold = 2;
+  ok = report_check( "merging", verify_churn( settings, s.seed ) ) && ok;
+  settings = octree_settings();
+
+  //fewer objects returned than with the plain run, none missed
+  settings.object_bounds = true;
+  ok = report_check( "object bounds", verify_churn( settings, s.seed ) ) && ok;
+
+  settings.fat_margin = 4;
+  settings.fat_lookahead = 1;
+  ok = report_check( "object and fat bounds", verify_churn( settings, s.seed ) ) && ok;
+
+  //merged objects keep their quantized bounds, moved into the cell they were pulled up into
+  settings.merge_threshold = 2;
+  ok = report_check( "object bounds and merging", verify_churn( settings, s.seed ) ) && ok;
+  settings = octree_settings();
+
+  //the late objects are only covered by the cells of the nodes they marked, until the next update refits them
+  settings.tight_bounds = true;
+  ok = report_check( "tight bounds", verify_churn( settings, s.seed ) ) && ok;
+
+  settings.object_bounds = true;
+  ok = report_check( "tight and object bounds", verify_churn( settings, s.seed ) ) && ok;
+  settings = octree_settings();
+
+  //the root is sized to the power of two cube around the world
+  float extent = verify_world_bounds();
+  cout << "  world bounds: " << ( extent >= 1024 ? "ok" : "FAILED" ) << ", root extent " << extent << endl;
+  ok = extent >= 1024 && ok;
+
+  //emptied sectors are freed
+  unsigned sectors = 0;
+  unsigned grid_failures = verify_grid( s.seed, sectors );
+  cout << "  grid: " << ( grid_failures || sectors ? "FAILED" : "ok" ) << ", " << grid_failures << " wrong, "
+    << sectors << " sectors left" << endl;
+  ok = !grid_failures && !sectors && ok;
+
+  size_t events = 0;
+  unsigned failures = verify_triggers( s.seed, events );
+  cout << "  triggers: " << ( failures ? "FAILED" : "ok" ) << ", " << events << " events, " << failures << " wrong" << endl;
+  ok = !failures && ok;
+
+  return ok;
+}
+
+//failed extraction zeroes the value, so only what was given is parsed
+template< class ty >
+static void parse( map<string, string>& args, const string& name, ty& value )
+{
+  if( args.count( name ) )
+  {
+    stringstream ss( args[name] );
+    ss >> value;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  map<string, string> args;
+
+  for( int c = 1; c < argc; ++c )
+  {
+    args[argv[c]] = c + 1 < argc ? argv[c + 1] : "";
+    ++c;
+  }
+
+  if( args.count( "--help" ) )
+  {
+    cout << "Octree benchmark" << endl <<
+      "Usage: --objects num      //number of objects (default: 100000)" << endl <<
+      "       --distribution str //uniform, clustered, planar or all (default: all)" << endl <<
+      "       --move ratio       //ratio of objects moving each frame (default: 0.05)" << endl <<
+      "       --speed num        //distance moved per frame (default: 1)" << endl <<
+      "       --frames num       //number of updated and queried frames (default: 100)" << endl <<
+      "       --removes num      //number of objects removed at the end (default: 1000)" << endl <<
+      "       --world num        //size of the world (default: 1000)" << endl <<
+      "       --seed num         //random seed (default: 1)" << endl <<
+      "       --margin num       //fat bounds margin of the objects (default: 0)" << endl <<
+      "       --lookahead num    //frames the fat bounds are swept along the velocity (default: 0)" << endl <<
+      "       --static 0/1       //insert the objects that don't move as static (default: 0)" << endl <<
+      "       --budget num       //nodes aged per update, 0 is unlimited (default: 0)" << endl <<
+      "       --merge num        //sparse subtree merge threshold, 0 is off (default: 0)" << endl <<
+      "       --bounds 0/1       //cull objects by their quantized bounds (default: 0)" << endl <<
+      "       --tight 0/1        //cull nodes by the bounds of their contents (default: 0)" << endl <<
+      "       --verify 0/1       //check queries against brute force under churn instead (default: 0)" << endl <<
+      "       --help             //display this information" << endl;
+    return 0;
+  }
+
+  scenario s;
+  s.distribution = args.count( "--distribution" ) ? args["--distribution"] : "all";
+  s.objects = 100000;
+  s.move_ratio = 0.05f;
+  s.speed = 1;
+  s.frames = 100;
+  s.removes = 1000;
+  s.world = 1000;
+  s.seed = 1;
+  s.margin = 0;
+  s.lookahead = 0;
+  s.split_static = false;
+  s.budget = 0;
+  s.merge = 0;
+  s.object_bounds = false;
+  s.tight_bounds = false;
+
+  parse( args, "--objects", s.objects );
+  parse( args, "--move", s.move_ratio );
+  parse( args, "--speed", s.speed );
+  parse( args, "--frames", s.frames );
+  parse( args, "--removes", s.removes );
+  parse( args, "--world", s.world );
+  parse( args, "--seed", s.seed );
+  parse( args, "--margin", s.margin );
+  parse( args, "--lookahead", s.lookahead );
+  parse( args, "--static", s.split_static );
+  parse( args, "--budget", s.budget );
+  parse( args, "--merge", s.merge );
+  parse( args, "--bounds", s.object_bounds );
+  parse( args, "--tight", s.tight_bounds );
+
+  if( !s.budget )
+    s.budget = ~0u;
+
+  shape::set_up_intersection();
+
+  bool check = false;
+  parse( args, "--verify", check );
+
+  if( check )
+    return verify( s ) ? 0 : 1;
+
+  if( s.distribution == "all" )
+  {
+    const char* distributions[] = { "uniform", "clustered", "planar" };
+    for( auto& d : distributions )
+    {
+      s.distribution = d;
+      run( s );
+    }
+  }
+  else
+  {
+    run( s );
+  }
+
+  return 0;
+}
@@ -0,0 +1,267 @@
+#ifndef dense_octree_h
+#define dense_octree_h
+
+#include "octree.h"
+#include <vector>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+//complete octree of a fixed depth for static scenes, built once from all of its objects
+//the levels are stored one after the other, nodes within a level in morton order,
+//so the c-th child of node m on level l is node (m << 3) | c on level l + 1
+//nodes have no pointers and no bounds, only the range of their objects and a mask of the children that hold any
+//objects that don't fit the world are kept in an overflow range after the nodes, which every query tests one by one
+//objects are given as aabbs or spheres
+template< class t, unsigned depth >
+class dense_octree
+{
+  static_assert( depth <= 8, "a complete octree deeper than 8 levels takes gigabytes" );
+
+  static const unsigned node_count = ( ( 1u << ( 3 * ( depth + 1 ) ) ) - 1 ) / 7;
+
+  aabb world; //bounds of the root, a cube
+  float cell_size[depth + 1]; //edge length of the nodes on each level
+
+  std::vector<uint32_t> first; //objects of node n are objects[first[n], first[n + 1]), the overflow is node_count
+  std::vector<uint8_t> child_mask; //children that have objects in their subtree
+  std::vector<t> objects;
+  std::vector<aabb> overflow_bounds; //of the overflow objects, in the same order
+
+  static unsigned get_level_offset( unsigned level )
+  {
+    return ( ( 1u << ( 3 * level ) ) - 1 ) / 7;
+  }
+
+  static unsigned spread( unsigned v )
+  {
+    unsigned r = 0;
+    for( unsigned c = 0; c < depth; ++c )
+      r |= ( ( v >> c ) & 1 ) << ( 3 * c );
+
+    return r;
+  }
+
+  static unsigned get_lowest_bit( unsigned mask )
+  {
+#ifdef _WIN32
+    unsigned long c;
+    _BitScanForward( &c, mask );
+    return c;
+#else
+    return __builtin_ctz( mask );
+#endif
+  }
+
+  aabb get_bv( unsigned level, unsigned m ) const
+  {
+    unsigned x = 0, y = 0, z = 0;
+    for( unsigned c = 0; c < level; ++c )
+    {
+      x |= ( ( m >> ( 3 * c ) ) & 1 ) << c;
+      y |= ( ( m >> ( 3 * c + 1 ) ) & 1 ) << c;
+      z |= ( ( m >> ( 3 * c + 2 ) ) & 1 ) << c;
+    }
+
+    aabb bv;
+    bv.min = world.min + mm::vec3( float( x ), float( y ), float( z ) ) * cell_size[level];
+    bv.max = bv.min + mm::vec3( cell_size[level] );
+    return bv;
+  }
+
+  static aabb get_bounds( shape* obv )
+  {
+    if( obv->get_class_index() == sphere::get_class_idx() )
+    {
+      sphere* s = static_cast<sphere*>( obv );
+      return aabb( s->get_center(), mm::vec3( s->get_radius() ) );
+    }
+
+    assert( obv->get_class_index() == aabb::get_class_idx() );
+    return *static_cast<aabb*>( obv );
+  }
+
+  //index of the deepest node that encloses b, node_count for objects that don't fit the world
+  unsigned get_node( aabb b ) const
+  {
+    aabb w = world;
+    if( !b.is_inside( &w ) )
+      return node_count;
+
+    //cell coordinates of the corners on the deepest level, the bits they share are the path down the tree
+    unsigned cells = 1u << depth;
+    unsigned lo[3], hi[3], diff = 0;
+
+    for( int c = 0; c < 3; ++c )
+    {
+      lo[c] = std::min( unsigned( ( b.min[c] - world.min[c] ) / cell_size[depth] ), cells - 1 );
+      hi[c] = std::min( unsigned( ( b.max[c] - world.min[c] ) / cell_size[depth] ), cells - 1 );
+      diff |= lo[c] ^ hi[c];
+    }
+
+    unsigned level = depth;
+    for( ; diff; diff >>= 1 )
+      --level;
+
+    unsigned shift = depth - level;
+    unsigned m = spread( lo[0] >> shift ) | ( spread( lo[1] >> shift ) << 1 ) | ( spread( lo[2] >> shift ) << 2 );
+
+    return get_level_offset( level ) + m;
+  }
+
+  void get_all_objects( unsigned level, unsigned m, std::vector<t>& objs, octree_query_stats* qs ) const
+  {
+    unsigned n = get_level_offset( level ) + m;
+
+    OCTREE_ADD( qs, objects_emitted, first[n + 1] - first[n] );
+
+    objs.insert( objs.end(), objects.begin() + first[n], objects.begin() + first[n + 1] );
+
+    for( unsigned mask = child_mask[n]; mask; mask &= mask - 1 )
+    {
+      OCTREE_COUNT( qs, nodes_visited );
+      get_all_objects( level + 1, ( m << 3 ) | get_lowest_bit( mask ), objs, qs );
+    }
+  }
+
+  void get_culled_objects( unsigned level, unsigned m, std::vector<t>& objs, shape* f, octree_query_stats* qs ) const
+  {
+    unsigned n = get_level_offset( level ) + m;
+    aabb bv = get_bv( level, m );
+
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    if( !bv.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    if( bv.can_be_inside( f ) )
+    {
+      OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+
+      if( bv.is_inside( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_accepted_fully );
+        get_all_objects( level, m, objs, qs );
+        return;
+      }
+    }
+
+    OCTREE_COUNT( qs, nodes_accepted_partially );
+    OCTREE_ADD( qs, objects_emitted, first[n + 1] - first[n] );
+
+    objs.insert( objs.end(), objects.begin() + first[n], objects.begin() + first[n + 1] );
+
+    for( unsigned mask = child_mask[n]; mask; mask &= mask - 1 )
+      get_culled_objects( level + 1, ( m << 3 ) | get_lowest_bit( mask ), objs, f, qs );
+  }
+
+public:
+
+  //the world is made a cube with the edge of its longest side
+  dense_octree( const aabb& w )
+  {
+    mm::vec3 size = w.max - w.min;
+    float edge = std::max( size.x, std::max( size.y, size.z ) );
+
+    world.min = w.min;
+    world.max = w.min + mm::vec3( edge );
+
+    for( unsigned c = 0; c <= depth; ++c )
+      cell_size[c] = edge / float( 1u << c );
+  }
+
+  //replaces whatever was built before
+  void build( const std::vector<std::pair<t, shape*> >& objs )
+  {
+    std::vector<unsigned> nodes( objs.size() );
+    std::vector<uint32_t> counts( node_count + 1, 0 );
+
+    for( size_t c = 0; c < objs.size(); ++c )
+    {
+      nodes[c] = get_node( get_bounds( objs[c].second ) );
+      ++counts[nodes[c]];
+    }
+
+    //prefix sum into the object ranges, the overflow range is the last one
+    first.assign( node_count + 2, 0 );
+    for( unsigned c = 0; c <= node_count; ++c )
+      first[c + 1] = first[c] + counts[c];
+
+    objects.resize( objs.size() );
+    overflow_bounds.resize( counts[node_count] );
+    std::vector<uint32_t> fill( first.begin(), first.end() - 1 );
+    for( size_t c = 0; c < objs.size(); ++c )
+    {
+      if( nodes[c] == node_count )
+        overflow_bounds[fill[node_count] - first[node_count]] = get_bounds( objs[c].second );
+
+      objects[fill[nodes[c]]++] = objs[c].first;
+    }
+
+    //mark the children with objects below them, bottom up
+    child_mask.assign( node_count, 0 );
+    for( unsigned level = depth; level > 0; --level )
+    {
+      unsigned offset = get_level_offset( level ), parent_offset = get_level_offset( level - 1 );
+
+      for( unsigned m = 0; m < ( 1u << ( 3 * level ) ); ++m )
+        if( first[offset + m + 1] != first[offset + m] || child_mask[offset + m] )
+          child_mask[parent_offset + ( m >> 3 )] |= 1 << ( m & 7 );
+    }
+  }
+
+  void get_culled_objects( std::vector<t>& objs, shape* f, octree_query_stats* qs = 0 ) const
+  {
+    assert( !first.empty() );
+
+    get_culled_objects( 0, 0, objs, f, qs );
+
+    for( uint32_t c = first[node_count]; c < first[node_count + 1]; ++c )
+    {
+      aabb b = overflow_bounds[c - first[node_count]];
+
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( b.is_intersecting( f ) )
+      {
+        OCTREE_COUNT( qs, objects_emitted );
+        objs.push_back( objects[c] );
+      }
+      else
+      {
+        OCTREE_COUNT( qs, objects_rejected );
+      }
+    }
+  }
+
+  //only the nodes that have objects in their subtree
+  void get_boxes( std::vector<aabb>& boxes ) const
+  {
+    for( unsigned level = 0; level <= depth; ++level )
+    {
+      unsigned offset = get_level_offset( level );
+
+      for( unsigned m = 0; m < ( 1u << ( 3 * level ) ); ++m )
+        if( first[offset + m + 1] != first[offset + m] || child_mask[offset + m] )
+          boxes.push_back( get_bv( level, m ) );
+    }
+  }
+
+  static unsigned get_node_count()
+  {
+    return node_count;
+  }
+
+  size_t get_memory_bytes() const
+  {
+    return first.capacity() * sizeof( uint32_t ) + child_mask.capacity() + objects.capacity() * sizeof( t ) + overflow_bounds.capacity() * sizeof( aabb );
+  }
+};
+
+#endif
@@ -37,6 +37,9 @@ _SHARING_EXTENSION "cl_APPLE_gl_sharing"
 #include <functional>
 
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #endif
 #undef NEAR
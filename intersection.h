@@ -43,6 +43,14 @@ public:
     callbacks[idx_lhs * elements + idx_rhs] = func;
   }
 
+  bool has( lhs _lhs, rhs _rhs )
+  {
+    int idx_lhs = _lhs->get_class_index();
+    int idx_rhs = _rhs->get_class_index();
+
+    return callbacks[idx_lhs * elements + idx_rhs] != 0;
+  }
+
   ret go( lhs _lhs, rhs _rhs )
   {
     int idx_lhs = _lhs->get_class_index();
@@ -87,6 +95,13 @@ public:
     return _is_inside.go( this, s );
   }
 
+  //tells if is_inside is implemented for this pair of shapes
+  bool can_be_inside( shape* s )
+  {
+    assert( is_setup );
+    return _is_inside.has( this, s );
+  }
+
   //x: min, y: max intersection
   mm::vec2 intersect( shape* s )
   {
@@ -805,6 +820,38 @@ namespace inner
     return false;
   }
 
+  //is a inside b?
+  static bool is_inside_af( shape* aa, shape* bb )
+  {
+    auto a = static_cast<aabb*>( aa );
+    auto b = static_cast<frustum*>( bb );
+
+    //the plane normals point inwards, so the whole box is inside
+    //if the vertex furthest against each normal is on the right side
+    for( int c = 0; c < 6; ++c )
+    {
+      if( b->planes[c].distance( a->get_neg_vertex( b->planes[c].get_normal() ) ) < 0 )
+        return false;
+    }
+
+    return true;
+  }
+
+  //is a inside b?
+  static bool is_inside_sf( shape* aa, shape* bb )
+  {
+    auto a = static_cast<sphere*>( aa );
+    auto b = static_cast<frustum*>( bb );
+
+    for( int c = 0; c < 6; ++c )
+    {
+      if( b->planes[c].distance( a->get_center() ) < a->get_radius() )
+        return false;
+    }
+
+    return true;
+  }
+
   static bool is_intersecting_rt( shape* aa, shape* bb )
   {
     auto a = static_cast<ray*>( aa );
@@ -1100,6 +1147,8 @@ void shape::set_up_intersection()
   _is_inside.add<aabb, sphere>( inner::is_inside_as );
   _is_inside.add<sphere, aabb>( inner::is_inside_sa );
   _is_inside.add<sphere, sphere>( inner::is_inside_ss );
+  _is_inside.add<aabb, frustum>( inner::is_inside_af );
+  _is_inside.add<sphere, frustum>( inner::is_inside_sf );
 
   _intersect.set_elements( 6 );
   _intersect.add<aabb, ray>( inner::intersect_ar );
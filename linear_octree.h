@@ -0,0 +1,464 @@
+#ifndef linear_octree_h
+#define linear_octree_h
+
+#include "octree.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdint.h>
+
+//octree without pointers, nodes live in an open addressing hash table keyed by their locational code
+//the code is a 1 bit sentinel followed by the morton code of the node, 3 bits per level (octant order of octree<t>)
+//so the root is 1, the children of a node are code << 3 | octant, and its parent is code >> 3
+//node bounds are not stored, they follow from the world bounds, the depth and the morton code
+//the world is fixed at construction, objects that don't fit it are kept in an overflow list that every query tests one by one
+template< class t >
+class linear_octree
+{
+  static const unsigned max_levels = 21; //3 * 21 bits + sentinel fits into 64 bits
+  static const uint64_t empty_key = 0; //no valid code is 0, the sentinel is always set
+
+  struct node
+  {
+    uint64_t key;
+    std::vector<t> objects;
+    unsigned char active_children; //bitmask
+  };
+
+  aabb world; //bounds of the root, a cube
+  unsigned levels; //deepest level, cells there are at least 1 unit wide like in octree<t>
+
+  std::vector<node> table; //power of two sized, at most half full
+  unsigned node_count;
+
+  struct object_entry
+  {
+    uint64_t key; //code of the node that stores the object, empty_key if it's in the overflow list
+    shape* bv;
+  };
+
+  std::unordered_map<t, object_entry> index;
+  std::vector<t> overflow; //objects that don't fit the world
+  std::vector<t> dirty; //objects marked as moved since the last update
+
+  static unsigned get_depth( uint64_t key )
+  {
+    unsigned depth = 0;
+    for( ; key > 1; key >>= 3 )
+      ++depth;
+
+    return depth;
+  }
+
+  size_t hash( uint64_t key ) const
+  {
+    return size_t( ( key * 0x9e3779b97f4a7c15ull ) >> 32 ) & ( table.size() - 1 );
+  }
+
+  node* find( uint64_t key )
+  {
+    for( size_t i = hash( key );; i = ( i + 1 ) & ( table.size() - 1 ) )
+    {
+      if( table[i].key == key )
+        return &table[i];
+
+      if( table[i].key == empty_key )
+        return 0;
+    }
+  }
+
+  void grow()
+  {
+    std::vector<node> old( table.size() * 2 );
+    old.swap( table );
+
+    for( auto& n : old )
+      if( n.key != empty_key )
+      {
+        size_t i = hash( n.key );
+        while( table[i].key != empty_key )
+          i = ( i + 1 ) & ( table.size() - 1 );
+
+        table[i].key = n.key;
+        table[i].objects.swap( n.objects );
+        table[i].active_children = n.active_children;
+      }
+  }
+
+  node* create( uint64_t key )
+  {
+    if( ( node_count + 1 ) * 2 > table.size() )
+      grow();
+
+    size_t i = hash( key );
+    while( table[i].key != empty_key )
+      i = ( i + 1 ) & ( table.size() - 1 );
+
+    table[i].key = key;
+    table[i].active_children = 0;
+    ++node_count;
+
+    return &table[i];
+  }
+
+  //backward shift deletion, so that lookups never need tombstones
+  void erase( node* n )
+  {
+    size_t i = n - table.data();
+    size_t mask = table.size() - 1;
+
+    std::vector<t>().swap( table[i].objects );
+    table[i].key = empty_key;
+    --node_count;
+
+    for( size_t j = ( i + 1 ) & mask; table[j].key != empty_key; j = ( j + 1 ) & mask )
+    {
+      size_t home = hash( table[j].key );
+
+      //move j into the hole if the hole is between its home slot and j
+      if( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) )
+      {
+        table[i].key = table[j].key;
+        table[i].objects.swap( table[j].objects );
+        table[i].active_children = table[j].active_children;
+        table[j].key = empty_key;
+        i = j;
+      }
+    }
+  }
+
+  aabb get_bv( uint64_t key ) const
+  {
+    unsigned depth = get_depth( key );
+    unsigned x = 0, y = 0, z = 0;
+
+    for( unsigned c = 0; c < depth; ++c )
+    {
+      x |= unsigned( ( key >> ( 3 * c ) ) & 1 ) << c;
+      y |= unsigned( ( key >> ( 3 * c + 1 ) ) & 1 ) << c;
+      z |= unsigned( ( key >> ( 3 * c + 2 ) ) & 1 ) << c;
+    }
+
+    float size = ( world.max.x - world.min.x ) / float( 1u << depth );
+
+    aabb bv;
+    bv.min = world.min + mm::vec3( float( x ), float( y ), float( z ) ) * size;
+    bv.max = bv.min + mm::vec3( size );
+    return bv;
+  }
+
+  //drops empty leaves, and the ancestors that become empty leaves because of it
+  void prune( uint64_t key )
+  {
+    node* n = find( key );
+
+    while( key > 1 && n && n->objects.empty() && !n->active_children )
+    {
+      erase( n );
+
+      uint64_t parent = key >> 3;
+      n = find( parent );
+      n->active_children &= ~( 1 << ( key & 7 ) );
+      key = parent;
+    }
+  }
+
+  void get_all_objects( uint64_t key, std::vector<t>& objs, octree_query_stats* qs )
+  {
+    node* n = find( key );
+
+    OCTREE_ADD( qs, objects_emitted, n->objects.size() );
+
+    objs.insert( objs.end(), n->objects.begin(), n->objects.end() );
+
+    unsigned char active = n->active_children;
+    for( int c = 0; c < 8; ++c )
+      if( active & ( 1 << c ) )
+      {
+        OCTREE_COUNT( qs, nodes_visited );
+        get_all_objects( ( key << 3 ) | c, objs, qs );
+      }
+  }
+
+  void get_culled_objects( uint64_t key, std::vector<t>& objs, shape* f, octree_query_stats* qs )
+  {
+    aabb bv = get_bv( key );
+
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    if( !bv.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    if( bv.can_be_inside( f ) )
+    {
+      OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+
+      if( bv.is_inside( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_accepted_fully );
+        get_all_objects( key, objs, qs );
+        return;
+      }
+    }
+
+    OCTREE_COUNT( qs, nodes_accepted_partially );
+
+    node* n = find( key );
+
+    OCTREE_ADD( qs, objects_emitted, n->objects.size() );
+
+    objs.insert( objs.end(), n->objects.begin(), n->objects.end() );
+
+    unsigned char active = n->active_children;
+    for( int c = 0; c < 8; ++c )
+      if( active & ( 1 << c ) )
+        get_culled_objects( ( key << 3 ) | c, objs, f, qs );
+  }
+
+public:
+
+  //the world is rounded up to a power of two sized cube, like octree<t>::set_world_bounds does
+  linear_octree( const aabb& w ) : levels( 0 ), node_count( 0 )
+  {
+    mm::vec3 size = w.max - w.min;
+    float edge = 1;
+
+    while( edge < size.x || edge < size.y || edge < size.z )
+      edge *= 2;
+
+    world.min = w.min;
+    world.max = w.min + mm::vec3( edge );
+
+    while( levels < max_levels && edge > 1 )
+    {
+      edge /= 2;
+      ++levels;
+    }
+
+    table.resize( 64 );
+    create( 1 ); //root
+  }
+
+  //objects are stored like in octree<t>, as deep as they fit, but nodes only split once they hold 3 objects
+  void insert( const t& o, shape* obv )
+  {
+    uint64_t key = 1;
+    unsigned depth = 0;
+
+    object_entry& e = index[o];
+    e.bv = obv;
+
+    if( !obv->is_inside( &world ) )
+    {
+      e.key = empty_key;
+      overflow.push_back( o );
+      return;
+    }
+
+    for( ;; )
+    {
+      node* n = find( key );
+
+      if( depth == levels || n->objects.size() < 3 )
+        break;
+
+      //find the octant the object fits into
+      aabb bv = get_bv( key );
+      mm::vec3 half = ( bv.max - bv.min ) * 0.5f;
+      int found = -1;
+
+      for( int c = 0; c < 8 && found < 0; ++c )
+      {
+        aabb child;
+        child.min = bv.min + mm::vec3( float( c & 1 ), float( ( c >> 1 ) & 1 ), float( ( c >> 2 ) & 1 ) ) * half;
+        child.max = child.min + half;
+
+        if( obv->is_inside( &child ) )
+          found = c;
+      }
+
+      if( found < 0 )
+        break; //straddles the octants
+
+      if( !( n->active_children & ( 1 << found ) ) )
+      {
+        n->active_children |= ( 1 << found );
+        create( ( key << 3 ) | found );
+      }
+
+      key = ( key << 3 ) | found;
+      ++depth;
+    }
+
+    find( key )->objects.push_back( o );
+    e.key = key;
+  }
+
+  bool remove( const t& o )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return false;
+
+    uint64_t key = it->second.key;
+    index.erase( it );
+
+    if( key == empty_key )
+    {
+      overflow.erase( std::find( overflow.begin(), overflow.end(), o ) );
+      return true;
+    }
+
+    node* n = find( key );
+
+    auto i = std::find( n->objects.begin(), n->objects.end(), o );
+    assert( i != n->objects.end() );
+    n->objects.erase( i );
+
+    prune( key );
+
+    return true;
+  }
+
+  //moves the object right away if it left its node, or the world
+  void reposition_object( const t& o, shape* obv )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return;
+
+    it->second.bv = obv;
+
+    if( it->second.key == empty_key )
+    {
+      if( !obv->is_inside( &world ) )
+        return;
+    }
+    else
+    {
+      aabb bv = get_bv( it->second.key );
+      if( obv->is_inside( &bv ) )
+        return;
+    }
+
+    remove( o );
+    insert( o, obv );
+  }
+
+  //like octree<t>, moved objects can be marked and repositioned together by the next update
+  void mark_dirty( const t& o )
+  {
+    dirty.push_back( o );
+  }
+
+  void mark_dirty( const t& o, shape* obv )
+  {
+    auto it = index.find( o );
+    if( it != index.end() )
+      it->second.bv = obv;
+
+    dirty.push_back( o );
+  }
+
+  //empty nodes are pruned right away, so there's nothing to age
+  octree_update_stats update()
+  {
+    octree_update_stats us;
+
+    for( auto& o : dirty )
+    {
+      auto it = index.find( o );
+      if( it == index.end() ) //might have been removed since it was marked
+        continue;
+
+      uint64_t key = it->second.key;
+
+      ++us.repositioned;
+      reposition_object( o, it->second.bv );
+
+      auto moved = index.find( o );
+      if( moved->second.key != key )
+        ++us.reinserted;
+    }
+
+    dirty.clear();
+
+    return us;
+  }
+
+  void get_culled_objects( std::vector<t>& objs, shape* f, octree_query_stats* qs = 0 )
+  {
+    get_culled_objects( 1, objs, f, qs );
+
+    for( auto& o : overflow )
+    {
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( index[o].bv->is_intersecting( f ) )
+      {
+        OCTREE_COUNT( qs, objects_emitted );
+        objs.push_back( o );
+      }
+      else
+      {
+        OCTREE_COUNT( qs, objects_rejected );
+      }
+    }
+  }
+
+  //the object is visible if its node and all of its ancestors intersect the query, no search needed
+  bool is_in_frustum( const t& o, shape* f, octree_query_stats* qs = 0 )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return false;
+
+    if( it->second.key == empty_key )
+    {
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+      return it->second.bv->is_intersecting( f );
+    }
+
+    for( uint64_t key = it->second.key; key; key >>= 3 )
+    {
+      aabb bv = get_bv( key );
+
+      OCTREE_COUNT( qs, nodes_visited );
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( !bv.is_intersecting( f ) )
+        return false;
+    }
+
+    return true;
+  }
+
+  void get_boxes( std::vector<aabb>& boxes )
+  {
+    for( auto& n : table )
+      if( n.key != empty_key )
+        boxes.push_back( get_bv( n.key ) );
+  }
+
+  unsigned get_node_count() const
+  {
+    return node_count;
+  }
+
+  //the table, including its empty slots, and the object lists
+  size_t get_memory_bytes() const
+  {
+    size_t bytes = table.capacity() * sizeof( node ) + overflow.capacity() * sizeof( t );
+
+    for( auto& n : table )
+      bytes += n.objects.capacity() * sizeof( t );
+
+    return bytes;
+  }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "framework.h"
 
+#define OCTREE_QUERY_STATS //show the traversal cost of the culling in the title
 #include "octree.h"
+#include "octree_snapshot.h"
 
 using namespace prototyper;
 
@@ -14,18 +16,6 @@ int main( int argc, char** argv )
   shape::set_up_intersection();
   o->set_up_octree(&o);
 
-  int size = 2500;
-
-  objects.reserve( size * size );
-
-  int counter = 0;
-  for(int x = 0; x < size; ++x)
-    for(int y = 0; y < size; ++y)
-    {
-      objects.push_back(make_pair(counter++, new aabb(vec3(x * 10, 0, y * 10), vec3(1))));
-      o->insert(objects.back().first, objects.back().second);
-    }
-
     /*
     cout << o->has_children() << endl;
     cout << o->is_empty() << endl;
@@ -109,6 +99,8 @@ int main( int argc, char** argv )
         "       --screenx num //set screen width (default:1280)" << endl <<
         "       --screeny num //set screen height (default:720)" << endl <<
         "       --fullscreen  //set fullscreen, windowed by default" << endl <<
+        "       --snapshot file //map the octree from file, or build it and save it there" << endl <<
+        "       --stats secs  //print octree statistics periodically" << endl <<
         "       --help        //display this information" << endl;
       return 0;
     }
@@ -121,6 +113,43 @@ int main( int argc, char** argv )
     }
     catch( ... ) {}
 
+    /*
+    * Build the octree, or map it from a snapshot if there's one
+    */
+
+    float stats_interval = 0;
+    ss.str( args["--stats"] );
+    ss >> stats_interval;
+    ss.clear();
+
+    octree_snapshot<unsigned> snapshot;
+    string snapshot_path = args["--snapshot"];
+
+    if( !snapshot_path.empty() && snapshot.load( snapshot_path ) )
+    {
+      cout << "Loaded octree snapshot: " << snapshot_path << endl;
+    }
+
+    int size = 2500;
+
+    objects.reserve( size * size );
+
+    int counter = 0;
+    for(int x = 0; x < size; ++x)
+      for(int y = 0; y < size; ++y)
+      {
+        objects.push_back(make_pair(counter++, new aabb(vec3(x * 10, 0, y * 10), vec3(1))));
+
+        if( !snapshot.is_loaded() )
+          o->insert(objects.back().first, objects.back().second);
+      }
+
+    if( !snapshot_path.empty() && !snapshot.is_loaded() )
+    {
+      if( o->save( snapshot_path ) )
+        cout << "Saved octree snapshot: " << snapshot_path << endl;
+    }
+
     /*
     * Initialize the OpenGL context
     */
@@ -266,6 +295,9 @@ int main( int argc, char** argv )
     sf::Clock movement_timer;
     movement_timer.restart();
 
+    sf::Clock stats_timer;
+    stats_timer.restart();
+
     frm.display( [&]
     {
       frm.handle_events( event_handler );
@@ -321,6 +353,7 @@ int main( int argc, char** argv )
       f.set_up( cam, the_frame );
       unsigned counter_octree = 0;
       unsigned counter_brute = 0;
+      octree_query_stats query_stats;
 
       /**
       glUniform3f(lighting_thecolor_loc, 0, 1, 0);
@@ -345,7 +378,10 @@ int main( int argc, char** argv )
       {
         static vector<unsigned> culled_objs;
         culled_objs.clear();
-        o->get_culled_objects( culled_objs, &f );
+        if( snapshot.is_loaded() )
+          snapshot.get_culled_objects( culled_objs, &f );
+        else
+          o->get_culled_objects( culled_objs, &f, cam.view_dir, false, &query_stats ); //front to back, for early-z
         counter_octree = culled_objs.size();
         glUniform3f(lighting_thecolor_loc, 0, 1, 0);
         for(auto& c : culled_objs)
@@ -368,10 +404,19 @@ int main( int argc, char** argv )
       }
       else
       {
+        //one traversal for the visibility of every object, instead of searching the tree for each
+        static vector<bool> visible;
+        visible.resize( objects.size() );
+
+        if( snapshot.is_loaded() )
+          snapshot.get_visibility( visible, &f );
+        else
+          o->get_visibility( visible, &f, &query_stats );
+
         glUniform3f(lighting_thecolor_loc, 0, 1, 0);
         for(auto& c : objects)
         {
-          if(o->is_in_frustum(c.first, &f))
+          if(visible[c.first])
           {
             ++counter_octree;
 
@@ -400,8 +445,18 @@ int main( int argc, char** argv )
       }
       /**/
 
+      if( stats_interval > 0 && !snapshot.is_loaded() && stats_timer.getElapsedTime().asSeconds() > stats_interval )
+      {
+        cout << o->stats() << endl;
+        stats_timer.restart();
+      }
+
       ss.str("");
-      ss << "Counter octree: " << counter_octree << " - Counter brute: " << counter_brute << " - Display culled objects: " << (!cull ? "true" : "false") << " - Render octree: " << (render_octree ? "true" : "false");
+      ss << "Counter octree: " << counter_octree << " - Counter brute: " << counter_brute
+        << " - Nodes visited: " << query_stats.nodes_visited << " (rejected: " << query_stats.nodes_rejected
+        << ", full: " << query_stats.nodes_accepted_fully << ", partial: " << query_stats.nodes_accepted_partially << ")"
+        << " - Frustum tests: " << query_stats.intersection_tests[frustum::get_class_idx()] + query_stats.containment_tests[frustum::get_class_idx()]
+        << " - Display culled objects: " << (!cull ? "true" : "false") << " - Render octree: " << (render_octree ? "true" : "false");
       frm.set_title(ss.str());
 
       //render the octree
@@ -412,7 +467,10 @@ int main( int argc, char** argv )
 
         static std::vector<aabb> boxes;
         boxes.clear();
-        o->get_boxes( boxes );
+        if( snapshot.is_loaded() )
+          snapshot.get_boxes( boxes );
+        else
+          o->get_boxes( boxes );
         for(auto& c : boxes)
         {
           if(c.is_intersecting(&f))
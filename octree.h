@@ -2,7 +2,362 @@
 #define octree_h
 
 #include "intersection.h"
+#include "octree_file.h"
 #include <vector>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <ostream>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+
+//structured report of the shape of an octree, see octree<t>::stats
+struct octree_stats
+{
+  static const unsigned max_depth = 32; //deeper levels are accumulated into the last bucket
+
+  unsigned depth; //number of levels below the node the stats were taken from
+  unsigned node_count;
+  unsigned leaf_count; //nodes without active children
+  unsigned empty_node_count; //nodes without objects
+  unsigned dying_node_count; //empty leaves that are counting down their life
+  unsigned object_count;
+  unsigned static_object_count; //included in object_count
+  unsigned straddler_count; //objects stuck in nodes that have children
+
+  unsigned nodes_per_depth[max_depth];
+  unsigned objects_per_depth[max_depth];
+  unsigned straddlers_per_depth[max_depth];
+
+  float object_fill; //average objects per node that has objects
+  float child_fill; //average fraction of the 8 children in use per inner node
+
+  size_t node_bytes; //nodes and their child arrays
+  size_t object_bytes; //object lists, including unused capacity
+
+  unsigned allocated_nodes; //all nodes alive on the heap, for every tree of this type
+  size_t allocated_bytes;
+  unsigned detached_nodes; //allocated but not reachable any more, only exact for the root of the only tree of its type
+
+  octree_stats()
+  {
+    std::fill( ( char* )this, ( char* )this + sizeof( *this ), 0 );
+  }
+};
+
+inline std::ostream& operator<<( std::ostream& o, const octree_stats& s )
+{
+  o << "nodes: " << s.node_count << " (leaves: " << s.leaf_count << ", empty: " << s.empty_node_count << ", dying: " << s.dying_node_count << ")" << std::endl;
+  o << "objects: " << s.object_count << " (static: " << s.static_object_count << ", straddlers: " << s.straddler_count << ")" << std::endl;
+  o << "depth: " << s.depth << ", object fill: " << s.object_fill << ", child fill: " << s.child_fill << std::endl;
+  o << "bytes: " << s.node_bytes + s.object_bytes << " (nodes: " << s.node_bytes << ", objects: " << s.object_bytes << ")" << std::endl;
+  o << "allocated: " << s.allocated_nodes << " nodes, " << s.allocated_bytes << " bytes (detached: " << s.detached_nodes << ")" << std::endl;
+
+  for( unsigned c = 0; c < s.depth && c < octree_stats::max_depth; ++c )
+    o << "  depth " << c << ": " << s.nodes_per_depth[c] << " nodes, " << s.objects_per_depth[c] << " objects, " << s.straddlers_per_depth[c] << " straddlers" << std::endl;
+
+  return o;
+}
+
+//cost of a single query, see octree<t>::get_culled_objects
+//the counters are only filled in when OCTREE_QUERY_STATS is defined
+struct octree_query_stats
+{
+  static const int shape_types = 6; //indexed by shape::get_class_index of the query shape
+
+  unsigned nodes_visited;
+  unsigned nodes_rejected;
+  unsigned nodes_accepted_fully; //the whole subtree was emitted without further tests
+  unsigned nodes_accepted_partially;
+  unsigned intersection_tests[shape_types];
+  unsigned containment_tests[shape_types];
+  unsigned objects_emitted;
+  unsigned objects_rejected; //culled by their own bounds, see octree<t>::set_object_bounds
+
+  octree_query_stats()
+  {
+    std::fill( ( char* )this, ( char* )this + sizeof( *this ), 0 );
+  }
+};
+
+//options of one tree, given to octree<t>::set_up_octree
+//they change what the nodes store, so they can only be changed while the tree is empty
+struct octree_settings
+{
+  float fat_margin; //objects are placed by their bounds grown by this much, see octree<t>::set_fat_bounds
+  float fat_lookahead; //and swept along their velocity for this many frames
+  unsigned merge_threshold; //see octree<t>::set_merge_threshold
+  bool object_bounds; //see octree<t>::set_object_bounds
+  bool tight_bounds; //see octree<t>::set_tight_bounds
+
+  octree_settings() : fat_margin( 0 ), fat_lookahead( 0 ), merge_threshold( 0 ), object_bounds( false ), tight_bounds( false )
+  {
+  }
+};
+
+//work done by a single octree<t>::update
+struct octree_update_stats
+{
+  unsigned repositioned; //dirty objects that were checked
+  unsigned reinserted; //objects that escaped their node and had to move
+  unsigned nodes_aged;
+  unsigned nodes_freed;
+  unsigned merges; //sparse subtrees that were pulled up into one node
+  unsigned nodes_pending; //left in the aging queue for the next update, because the budget ran out
+
+  octree_update_stats() : repositioned( 0 ), reinserted( 0 ), nodes_aged( 0 ), nodes_freed( 0 ), merges( 0 ), nodes_pending( 0 )
+  {
+  }
+};
+
+//screen space size culling and lod selection, see octree<t>::get_culled_objects
+//sizes are the diagonal of a box seen from its point nearest to the eye, so nothing inside a box looks bigger than the box
+struct octree_screen_query
+{
+  mm::vec3 eye;
+  float scale; //pixels per unit at a distance of 1, or at any distance for ortographic projections
+  bool is_perspective;
+  float min_pixels; //nodes and objects smaller than this are culled
+  std::vector<float> lod_pixels; //lod c is for objects at least lod_pixels[c] big, in decreasing order, smaller ones get the last lod + 1
+
+  octree_screen_query( const mm::camera<float>& cam, const mm::frame<float>& fr, float screen_height, float min_size )
+    : eye( cam.pos ), scale( fr.projection_matrix[1].y * screen_height * 0.5f ), is_perspective( fr.projection_matrix[3].w == 0 ), min_pixels( min_size )
+  {
+  }
+
+  float get_pixels( const aabb& b ) const
+  {
+    float size = mm::length( b.max - b.min ) * scale;
+
+    if( !is_perspective )
+      return size;
+
+    float dist = mm::length( mm::clamp( eye, b.min, b.max ) - eye );
+    return dist > 0 ? size / dist : std::numeric_limits<float>::max();
+  }
+
+  unsigned get_lod( float pixels ) const
+  {
+    unsigned lod = 0;
+    while( lod < lod_pixels.size() && pixels < lod_pixels[lod] )
+      ++lod;
+
+    return lod;
+  }
+};
+
+//a cut through the tree, see octree<t>::get_cut
+//nearby objects are returned one by one, far away nodes as a single proxy that stands for their whole subtree
+template< class t >
+struct octree_cut
+{
+  struct proxy
+  {
+    aabb bounds; //of the contents of the node with tight bounds on, its cell otherwise
+    unsigned object_count; //objects in the subtree
+    unsigned first_representative; //into representatives
+    unsigned representative_count;
+  };
+
+  std::vector<t> objects;
+  std::vector<proxy> proxies;
+  std::vector<t> representatives; //a few objects of each proxy, to draw it with or to build an impostor from
+
+  void clear()
+  {
+    objects.clear();
+    proxies.clear();
+    representatives.clear();
+  }
+};
+
+//the visible set of one view of one tree, kept between frames, see octree<t>::update_visible_set
+template< class t >
+struct octree_visible_set
+{
+  std::vector<t> entered; //since the previous update
+  std::vector<t> exited;
+  std::unordered_set<t> visible;
+
+  //how each node was classified last time, nodes that were freed are forgotten once they pile up
+  std::unordered_map<const void*, unsigned char> node_states;
+  unsigned epoch; //of the tree at the previous update
+  unsigned removals;
+  std::vector<t> scratch;
+
+  octree_visible_set() : epoch( 0 ), removals( 0 )
+  {
+  }
+
+  //forgets everything, the next update reports every visible object as entered
+  void clear()
+  {
+    entered.clear();
+    exited.clear();
+    visible.clear();
+    node_states.clear();
+    epoch = 0;
+    removals = 0;
+  }
+};
+
+//an object entering, staying in or leaving a trigger volume, see octree<t>::insert_trigger
+template< class t >
+struct octree_trigger_event
+{
+  enum event_type
+  {
+    enter = 0, stay, exit
+  };
+
+  t trigger;
+  t object;
+  event_type type;
+};
+
+//results of recent queries of one tree, see octree<t>::get_culled_objects
+//queries are told apart by their shape quantized to precision, so shapes closer than that share their results
+//a result is valid as long as the version of the tree doesn't change, see octree<t>::get_version
+//boxes, spheres and frustums are cached, other shapes are always queried
+template< class t >
+struct octree_query_cache
+{
+  struct entry
+  {
+    std::vector<int32_t> key;
+    unsigned version;
+    unsigned last_used;
+    std::vector<t> objects;
+  };
+
+  std::vector<entry> entries;
+  float precision; //in world units for positions and sizes, and for plane normals as is
+  unsigned hits;
+  unsigned misses;
+  unsigned clock;
+  std::vector<int32_t> key; //of the current query
+
+  octree_query_cache( unsigned max_entries = 4, float prec = 1.0f / 1024 ) : entries( max_entries ), precision( prec ), hits( 0 ), misses( 0 ), clock( 0 )
+  {
+    assert( max_entries > 0 && precision > 0 );
+
+    for( auto& e : entries )
+      e.last_used = 0;
+  }
+
+  int32_t quantize( float v ) const
+  {
+    return int32_t( std::floor( v / precision + 0.5f ) );
+  }
+
+  //fills key, returns false for shapes that aren't cached
+  bool set_key( shape* f )
+  {
+    key.clear();
+    key.push_back( f->get_class_index() );
+
+    if( f->get_class_index() == aabb::get_class_idx() )
+    {
+      aabb* b = static_cast<aabb*>( f );
+
+      for( int c = 0; c < 3; ++c )
+      {
+        key.push_back( quantize( b->min[c] ) );
+        key.push_back( quantize( b->max[c] ) );
+      }
+    }
+    else if( f->get_class_index() == sphere::get_class_idx() )
+    {
+      sphere* sp = static_cast<sphere*>( f );
+      mm::vec3 center = sp->get_center();
+
+      for( int c = 0; c < 3; ++c )
+        key.push_back( quantize( center[c] ) );
+
+      key.push_back( quantize( sp->get_radius() ) );
+    }
+    else if( f->get_class_index() == frustum::get_class_idx() )
+    {
+      frustum* fr = static_cast<frustum*>( f );
+
+      for( int p = 0; p < 6; ++p )
+      {
+        mm::vec3 n = fr->planes[p].get_normal();
+
+        for( int c = 0; c < 3; ++c )
+          key.push_back( quantize( n[c] ) );
+
+        key.push_back( quantize( fr->planes[p].get_minus_n_dot_p() ) );
+      }
+    }
+    else
+      return false;
+
+    return true;
+  }
+
+  //the entry of the current key, or 0
+  entry* find( unsigned version )
+  {
+    for( auto& e : entries )
+      if( e.last_used && e.version == version && e.key == key )
+      {
+        e.last_used = ++clock;
+        return &e;
+      }
+
+    return 0;
+  }
+
+  //the entry to store the result of the current key in, stale entries go first, then the least recently used one
+  entry& claim( unsigned version )
+  {
+    entry* victim = &entries[0];
+
+    for( auto& e : entries )
+    {
+      if( !e.last_used || e.version != version )
+      {
+        victim = &e;
+        break;
+      }
+
+      if( e.last_used < victim->last_used )
+        victim = &e;
+    }
+
+    victim->key = key;
+    victim->version = version;
+    victim->last_used = ++clock;
+    victim->objects.clear();
+
+    return *victim;
+  }
+
+  void clear()
+  {
+    for( auto& e : entries )
+    {
+      e.last_used = 0;
+      e.objects.clear();
+    }
+  }
+};
+
+#ifdef OCTREE_QUERY_STATS
+#define OCTREE_COUNT( qs, counter ) if( qs ) ++( qs )->counter
+#define OCTREE_ADD( qs, counter, n ) if( qs ) ( qs )->counter += unsigned( n )
+#else
+//still names qs, so a parameter only used for counting is not unused
+#define OCTREE_COUNT( qs, counter ) ( void )( qs )
+#define OCTREE_ADD( qs, counter, n ) ( void )( qs )
+#endif
 
 template< class t >
 class octree
@@ -10,9 +365,76 @@ class octree
   static const mm::vec3 min_bv_size; //1x1x1 box
   static const int max_life_boundary; //64
   static bool is_setup;
-  static octree** root_ptr; //in order to expand the octree we need to be able to modify the root node that the user has
+  static std::atomic<unsigned> allocated_nodes; //all nodes alive, including branches that were cut off the tree
+
+  struct object_entry
+  {
+    octree* node; //node that stores the object
+    shape* bv; //bounding volume the object was inserted or marked dirty with
+    bool is_static; //stored in the static list of its node
+
+    object_entry() : node( 0 ), bv( 0 ), is_static( false )
+    {
+    }
+  };
+
+  //enlarged bounds a moving object was placed with, the object is only moved once its bv escapes them
+  //plain floats, an aabb would carry a vtable for every object
+  struct fat_bounds
+  {
+    float min[3], max[3];
+  };
+
+  //bounds of an object in 1/65535ths of the cell of its node, rounded outwards
+  struct object_bounds
+  {
+    uint16_t min[3], max[3];
+  };
+
+  //what a node keeps for the object bounds and tight bounds settings, only trees with one of them on allocate it
+  struct node_bounds
+  {
+    std::vector<object_bounds> objects; //of the static objects then the dynamic ones, only kept if object bounds are on
+    object_bounds tight; //bounds of everything in the subtree, in the cell of this node
+    object_bounds own; //bounds of the objects of this node alone
+    bool is_refit_pending; //something changed in the subtree since tight was refit, queries use the cell until then
+    bool is_own_refit_pending; //objects left or moved within this node since own was refit
+
+    node_bounds() : is_refit_pending( true ), is_own_refit_pending( true )
+    {
+    }
+  };
+
+  //bookkeeping of one tree, shared by all of its nodes
+  //trees don't share anything that changes, so separate trees can be updated in parallel
+  struct tree_state
+  {
+    octree** root_ptr; //in order to expand the octree we need to be able to modify the root node that the user has
+    std::unordered_map<t, object_entry> index; //where each object is stored
+    std::unordered_map<t, fat_bounds> fat; //of the moving objects, only kept if fat bounds are on and object bounds are off
+    std::unordered_map<t, mm::vec3> velocities; //of the objects given one, only kept if fat bounds look ahead
+    std::vector<t> dirty; //objects marked as moved since the last update
+    std::vector<octree*> aging; //nodes that lost objects or children, and empty leaves counting down their life
+    aabb root_bv; //bounding volume of the root, the bounds of every other node follow from it and the octants on the way down
+    aabb world_bv; //cube set_world_bounds sized the root to, the root never collapses below it
+    bool has_world_bounds;
+    octree_settings settings;
+    unsigned epoch; //counts the changes of the tree, see octree<t>::mark_changed
+    unsigned removals; //objects removed so far
+    octree* trigger_root; //trigger volumes live in a tree of their own, 0 until the first one is inserted
+    std::unordered_map<t, std::vector<t> > trigger_contacts; //triggers each object overlaps
+    std::unordered_map<t, std::unordered_set<t> > trigger_objects; //objects each trigger overlaps, the same contacts the other way
+    std::vector<t> trigger_checks; //objects inserted or moved since the last update
+    std::vector<t> changed_triggers; //triggers inserted or moved since the last update
+    std::vector<octree_trigger_event<t> > trigger_events; //of the last update
+    std::vector<octree_trigger_event<t> > pending_trigger_events; //exits caused by removals since the last update
+
+    tree_state() : root_ptr( 0 ), has_world_bounds( false ), epoch( 0 ), removals( 0 ), trigger_root( 0 )
+    {
+    }
+  };
 
-  aabb bv; //bounding volume of this node
+  tree_state* state;
 
   //0: left-bottom-front
   //1: right-bottom-front
@@ -22,440 +444,2400 @@ class octree
   //5: right-bottom-back
   //6: left-top-back
   //7: right-top-back
-  //Should be able to store only one pointer, and add an offset to it, to address
-  //all of the children
-  vector<octree<t>*> children; //child nodes
-  int life;
+  //the 8 pointers are allocated with the first child and freed with the last, so leaves only pay for one
+  octree<t>** children; //child nodes, 0 while there are none
 
-  std::vector<t> objects; //objects stored in this node
-  octree* parent;  
+  std::vector<t> objects; //dynamic objects stored in this node
+  std::vector<t> static_objects; //objects that are not expected to move, kept apart so that churn never touches them
+  octree* parent;
+  node_bounds* nb; //0 until the node stores object bounds or is refit, which counts as refit pending
+  int life;
+  unsigned subtree_count; //objects stored in this node and below
   int max_lifespan;
+  unsigned epoch; //epoch of the tree when something last changed in the subtree
+  unsigned own_epoch; //same, for the objects of this node alone
   char active_children; //bitmask
+  bool is_aging; //queued in aging
+  unsigned char octant; //index of this node in the children of its parent
 
+  //grows the root until it encloses obv
+  //every level is worked out first, then the chain of new roots is allocated in one go
   void expand_octree( shape* obv )
   {
     assert( is_setup );
 
-    unsigned octant = 8; //will contain which octant was the original node
-
-    mm::vec3 extsize = bv.get_extents() * 2; //half-size of the new root node
+    static const unsigned max_levels = 64; //the float range runs out well before this
 
-    //find out in which octant is the current root node
-    //based on the object's bv (that is outside the current root node)
-    plane octree_planes[3];
-    octree_planes[0] = plane( mm::vec3( 1, 0, 0 ), bv.get_pos() + mm::vec3( bv.get_extents().x, 0, 0 ) );
-    octree_planes[1] = plane( mm::vec3( 0, 1, 0 ), bv.get_pos() + mm::vec3( 0, bv.get_extents().y, 0 ) );
-    octree_planes[2] = plane( mm::vec3( 0, 0, 1 ), bv.get_pos() + mm::vec3( 0, 0, bv.get_extents().z ) );
+    aabb b = get_bounds( obv );
+    aabb levels[max_levels];
+    unsigned octants[max_levels]; //octant of the previous root in the new one
+    unsigned count = 0;
 
-    bool is_right = obv->is_on_right_side( &octree_planes[0] ),
-      is_top = obv->is_on_right_side( &octree_planes[1] ),
-      is_back = obv->is_on_right_side( &octree_planes[2] );
+    aabb cur = state->root_bv;
+    mm::vec3 center = b.get_pos();
 
-    if( is_right )
+    do
     {
-      if( is_top )
+      mm::vec3 size = cur.max - cur.min;
+      mm::vec3 cur_center = cur.get_pos();
+      unsigned octant = 0;
+
+      for( int c = 0; c < 3; ++c )
       {
-        if( is_back )
+        //grow towards the object, the old root ends up on the opposite side
+        bool grow_down = b.min[c] < cur.min[c] || ( b.max[c] <= cur.max[c] && center[c] < cur_center[c] );
+
+        if( grow_down )
         {
-          octant = 7;
+          cur.min[c] -= size[c];
+          octant |= 1 << c;
         }
         else
-        {
-          octant = 3;
-        }
+          cur.max[c] += size[c];
       }
-      else
-      {
-        if( is_back )
-        {
-          octant = 5;
-        }
-        else
-        {
-          octant = 1;
-        }
+
+      levels[count] = cur;
+      octants[count] = octant;
+      ++count;
+    }
+    while( !b.is_inside( &cur ) && count < max_levels );
+
+    octree<t>* child = *state->root_ptr;
+    assert( child == this );
+
+    for( unsigned c = 0; c < count; ++c )
+    {
+      auto newroot = new octree();
+      newroot->state = state;
+      newroot->set_child( octants[c], child );
+      newroot->subtree_count = child->subtree_count;
+      newroot->epoch = ++state->epoch;
+      child->parent = newroot;
+      child->octant = octants[c];
+      child = newroot;
+    }
+
+    *state->root_ptr = child;
+    state->root_bv = levels[count - 1];
+  }
+
+  bool is_fat_enabled() const
+  {
+    return state->settings.fat_margin > 0 || state->settings.fat_lookahead > 0;
+  }
+
+  //axis aligned box around a bounding volume, only aabbs and spheres are supported
+  static aabb get_bounds( shape* obv )
+  {
+    if( obv->get_class_index() == sphere::get_class_idx() )
+    {
+      sphere* s = ( sphere* )obv;
+      return aabb( s->get_center(), mm::vec3( s->get_radius() ) );
+    }
+
+    assert( obv->get_class_index() == aabb::get_class_idx() );
+    return *( aabb* )obv;
+  }
+
+  aabb get_fat_bounds( shape* obv, const mm::vec3& velocity ) const
+  {
+    const octree_settings& settings = state->settings;
+    aabb fat = get_bounds( obv );
+    fat.min = fat.min - mm::vec3( settings.fat_margin );
+    fat.max = fat.max + mm::vec3( settings.fat_margin );
+
+    if( settings.fat_lookahead > 0 )
+    {
+      mm::vec3 sweep = velocity * settings.fat_lookahead;
+      fat.expand( fat.min + sweep );
+      fat.expand( fat.max + sweep );
+    }
+
+    return fat;
+  }
+
+  static object_bounds quantize( shape* obv, const aabb& bv )
+  {
+    return quantize( get_bounds( obv ), bv );
+  }
+
+  static object_bounds quantize( const aabb& b, const aabb& bv )
+  {
+    static const float steps = 65535;
+
+    float scale = steps / ( bv.max.x - bv.min.x );
+
+    object_bounds q;
+    for( int c = 0; c < 3; ++c )
+    {
+      //a step of slack on both sides makes up for the rounding of the floats
+      float lo = std::floor( ( b.min[c] - bv.min[c] ) * scale ) - 1;
+      float hi = std::ceil( ( b.max[c] - bv.min[c] ) * scale ) + 1;
+      q.min[c] = uint16_t( std::min( std::max( lo, 0.0f ), steps ) );
+      q.max[c] = uint16_t( std::min( std::max( hi, 0.0f ), steps ) );
+    }
+
+    return q;
+  }
+
+  static aabb dequantize( const object_bounds& q, const aabb& bv )
+  {
+    float step = ( bv.max.x - bv.min.x ) / 65535;
+
+    aabb b;
+    b.min = bv.min + mm::vec3( float( q.min[0] ), float( q.min[1] ), float( q.min[2] ) ) * step;
+    b.max = bv.min + mm::vec3( float( q.max[0] ), float( q.max[1] ), float( q.max[2] ) ) * step;
+    return b;
+  }
+
+  static object_bounds get_empty_bounds()
+  {
+    object_bounds q;
+    for( int c = 0; c < 3; ++c )
+    {
+      q.min[c] = 65535;
+      q.max[c] = 0;
+    }
+
+    return q;
+  }
+
+  static bool is_empty( const object_bounds& q )
+  {
+    return q.min[0] > q.max[0];
+  }
+
+  static void merge( object_bounds& into, const object_bounds& q )
+  {
+    for( int c = 0; c < 3; ++c )
+    {
+      into.min[c] = std::min( into.min[c], q.min[c] );
+      into.max[c] = std::max( into.max[c], q.max[c] );
+    }
+  }
+
+  //bounds in the cell of the c-th child to bounds in the cell of its parent, rounded outwards
+  static object_bounds get_parent_bounds( const object_bounds& q, unsigned c )
+  {
+    object_bounds p;
+    for( int i = 0; i < 3; ++i )
+    {
+      unsigned offset = ( ( c >> i ) & 1 ) * 65535;
+      p.min[i] = uint16_t( ( offset + q.min[i] ) >> 1 );
+      p.max[i] = uint16_t( ( offset + q.max[i] + 1 ) >> 1 );
+    }
+
+    return p;
+  }
+
+  static bool is_overlapping( const object_bounds& a, const object_bounds& b )
+  {
+    return a.min[0] <= b.max[0] && a.max[0] >= b.min[0] &&
+      a.min[1] <= b.max[1] && a.max[1] >= b.min[1] &&
+      a.min[2] <= b.max[2] && a.max[2] >= b.min[2];
+  }
+
+  static aabb unpack( const fat_bounds& f )
+  {
+    aabb b;
+    b.min = mm::vec3( f.min[0], f.min[1], f.min[2] );
+    b.max = mm::vec3( f.max[0], f.max[1], f.max[2] );
+    return b;
+  }
+
+  static fat_bounds pack( const aabb& b )
+  {
+    fat_bounds f;
+
+    for( int c = 0; c < 3; ++c )
+    {
+      f.min[c] = b.min[c];
+      f.max[c] = b.max[c];
+    }
+
+    return f;
+  }
+
+  mm::vec3 get_velocity( const t& o ) const
+  {
+    auto it = state->velocities.find( o );
+    return it != state->velocities.end() ? it->second : mm::vec3( 0 );
+  }
+
+  //the bounds an object was placed with, it stays inside them until it is repositioned
+  //with object bounds on the enlarged bounds aren't kept, the quantized bounds of the node are used instead
+  aabb get_placed_bounds( const t& o, const object_entry& e ) const
+  {
+    if( e.is_static || !is_fat_enabled() )
+      return get_bounds( e.bv );
+
+    assert( !state->settings.object_bounds );
+
+    auto it = state->fat.find( o );
+    assert( it != state->fat.end() );
+    return unpack( it->second );
+  }
+
+  //bounds of the c-th octant of a node with bounds bv
+  static aabb get_child_bv( const aabb& bv, unsigned c )
+  {
+    mm::vec3 half = ( bv.max - bv.min ) * 0.5f;
+
+    aabb child;
+    child.min = bv.min + mm::vec3( float( c & 1 ), float( ( c >> 1 ) & 1 ), float( ( c >> 2 ) & 1 ) ) * half;
+    child.max = child.min + half;
+    return child;
+  }
+
+  //nodes don't store their bounds, they are worked out from the root down
+  //traversals pass them along instead of calling this
+  aabb get_bv()
+  {
+    assert( is_setup );
+
+    if( !parent )
+      return state->root_bv;
+
+    return get_child_bv( parent->get_bv(), octant );
+  }
+
+  //deepest node on the path from the root to this node that encloses obv, bv receives its bounds
+  //returns 0 if not even the root does
+  octree* get_fitting_parent( shape* obv, aabb& bv )
+  {
+    assert( is_setup );
+
+    if( !parent ) //this is the root node
+    {
+      bv = state->root_bv;
+      return obv->is_inside( &bv ) ? this : 0;
+    }
+
+    octree* p = parent->get_fitting_parent( obv, bv );
+    if( p != parent ) //stopped above
+      return p;
+
+    aabb cbv = get_child_bv( bv, octant );
+    if( !obv->is_inside( &cbv ) )
+      return parent;
+
+    bv = cbv;
+    return this;
+  }
+
+  size_t get_object_count() const
+  {
+    return objects.size() + static_objects.size();
+  }
+
+  //index of an object of this node in bounds
+  size_t get_bounds_index( const t& o, bool is_static )
+  {
+    if( is_static )
+      return std::find( static_objects.begin(), static_objects.end(), o ) - static_objects.begin();
+
+    return static_objects.size() + ( std::find( objects.begin(), objects.end(), o ) - objects.begin() );
+  }
+
+  //objects arrived, left or moved in this node
+  //flags the path to the root for refitting, and stamps it with a new epoch of the tree
+  void mark_changed()
+  {
+    unsigned e = ++state->epoch;
+    own_epoch = e;
+
+    for( octree<t>* n = this; n; n = n->parent )
+    {
+      if( n->nb )
+        n->nb->is_refit_pending = true;
+
+      n->epoch = e;
+    }
+  }
+
+  bool is_refit_pending() const
+  {
+    return !nb || nb->is_refit_pending;
+  }
+
+  node_bounds& get_node_bounds()
+  {
+    if( !nb )
+      nb = new node_bounds;
+
+    return *nb;
+  }
+
+  //arriving and moving objects only grow the bounds of a node right away, they shrink once an object leaves
+  //bv is the bounds of this node
+  void grow_own_bounds( shape* pbv, const aabb& bv )
+  {
+    if( !nb )
+      return; //never refit, so it's pending anyway
+
+    if( state->settings.tight_bounds && !nb->is_own_refit_pending )
+      merge( nb->own, quantize( pbv, bv ) );
+    else
+      nb->is_own_refit_pending = true;
+  }
+
+  //obv is stored with the object, pbv is the bounds it is placed with, bv is the bounds of this node
+  void store_object( const t& o, shape* obv, shape* pbv, const aabb& bv )
+  {
+    for( octree<t>* n = this; n; n = n->parent )
+      ++n->subtree_count;
+
+    mark_changed();
+
+    object_entry& e = state->index[o];
+    e.node = this;
+    e.bv = obv;
+
+    grow_own_bounds( pbv, bv );
+
+    if( state->settings.object_bounds )
+    {
+      object_bounds q = quantize( pbv, bv );
+      std::vector<object_bounds>& bounds = get_node_bounds().objects;
+
+      if( e.is_static )
+        bounds.insert( bounds.begin() + static_objects.size(), q );
+      else
+        bounds.push_back( q );
+    }
+
+    if( e.is_static )
+    {
+      static_objects.push_back( o );
+      std::vector<t>( static_objects ).swap( static_objects ); //trim the fat
+    }
+    else
+      objects.push_back( o ); //capacity is kept, dynamic objects come and go
+  }
+
+  void erase_object( const t& o, bool is_static )
+  {
+    std::vector<t>& list = is_static ? static_objects : objects;
+
+    auto i = std::find( list.begin(), list.end(), o );
+    assert( i != list.end() );
+
+    if( state->settings.object_bounds )
+      nb->objects.erase( nb->objects.begin() + ( is_static ? 0 : static_objects.size() ) + ( i - list.begin() ) );
+
+    list.erase( i );
+    queue_aging();
+
+    if( nb )
+      nb->is_own_refit_pending = true;
+
+    for( octree<t>* n = this; n; n = n->parent )
+      --n->subtree_count;
+
+    mark_changed();
+  }
+
+  //moves every object below this node into into, the emptied nodes are left to die of age
+  //bv is the bounds of this node, into_bv the bounds of into
+  void pull_up( octree<t>* into, const aabb& bv, const aabb& into_bv )
+  {
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->pull_up( into, get_child_bv( bv, c ), into_bv );
+
+    if( this == into )
+    {
+      std::vector<t>( static_objects ).swap( static_objects ); //trim the fat
+
+      if( nb )
+        nb->is_own_refit_pending = true;
+
+      mark_changed();
+
+      return;
+    }
+
+    for( auto& o : objects )
+      state->index[o].node = into;
+
+    for( auto& o : static_objects )
+      state->index[o].node = into;
+
+    //the bounds are moved from this cell into the cell of into, which only rounds them outwards
+    //so they still enclose the bounds the objects were placed with
+    if( state->settings.object_bounds && get_object_count() )
+    {
+      std::vector<object_bounds>& bounds = nb->objects;
+      std::vector<object_bounds>& into_bounds = into->get_node_bounds().objects;
+
+      for( auto& q : bounds )
+        q = quantize( dequantize( q, bv ), into_bv );
+
+      auto statics_end = bounds.begin() + static_objects.size();
+      into_bounds.insert( into_bounds.begin() + into->static_objects.size(), bounds.begin(), statics_end );
+      into_bounds.insert( into_bounds.end(), statics_end, bounds.end() );
+    }
+
+    into->objects.insert( into->objects.end(), objects.begin(), objects.end() );
+    into->static_objects.insert( into->static_objects.end(), static_objects.begin(), static_objects.end() );
+
+    std::vector<t>().swap( objects );
+    std::vector<t>().swap( static_objects );
+    subtree_count = 0;
+
+    if( nb )
+      std::vector<object_bounds>().swap( nb->objects );
+
+    queue_aging();
+  }
+
+  //pulls up the objects of the highest sparse subtree above this node
+  //nodes split when a 4th object arrives, so any threshold below 3 leaves room for hysteresis
+  bool merge_sparse_parents()
+  {
+    octree<t>* m = 0;
+
+    for( octree<t>* n = this; n && n->subtree_count <= state->settings.merge_threshold; n = n->parent )
+      if( n->subtree_count > n->get_object_count() ) //it has objects below it
+        m = n;
+
+    if( m )
+    {
+      aabb bv = m->get_bv();
+      m->pull_up( m, bv, bv );
+    }
+
+    return m != 0;
+  }
+
+  void queue_aging()
+  {
+    if( !is_aging )
+    {
+      is_aging = true;
+      state->aging.push_back( this );
+    }
+  }
+
+  //moves an object of this node up the tree if it doesn't fit anymore
+  //returns true if the object had to be reinserted
+  bool reposition( const t& o, object_entry& e )
+  {
+    shape* pbv = e.bv; //the bounds the object is placed with
+    aabb fat;
+
+    if( !e.is_static && is_fat_enabled() )
+    {
+      //with object bounds on the quantized bounds stand in for the enlarged ones, they enclose them
+      if( state->settings.object_bounds )
+        fat = dequantize( nb->objects[get_bounds_index( o, false )], get_bv() );
+      else
+        fat = unpack( state->fat[o] );
+
+      if( e.bv->is_inside( &fat ) )
+        return false; //still inside its enlarged bounds, nothing to do
+
+      fat = get_fat_bounds( e.bv, get_velocity( o ) );
+      pbv = &fat;
+
+      if( !state->settings.object_bounds )
+        state->fat[o] = pack( fat );
+    }
+
+    aabb bv;
+    auto c = get_fitting_parent( pbv, bv );
+    if( c == this )
+    {
+      //object still fits, only its bounds within the node change
+      if( state->settings.object_bounds )
+        nb->objects[get_bounds_index( o, e.is_static )] = quantize( pbv, bv );
+
+      grow_own_bounds( pbv, bv );
+      mark_changed();
+
+      return false;
+    }
+
+    erase_object( o, e.is_static );
+
+    if( c )
+      c->place( o, e.bv, pbv, bv ); //try to insert it as far down as possible
+    else
+    {
+      ( *state->root_ptr )->expand_octree( pbv );
+      ( *state->root_ptr )->place( o, e.bv, pbv, state->root_bv );
+    }
+
+    return true;
+  }
+
+  //only the queued nodes are aged, empty leaves die after their lifespan and are cut off the tree
+  //at most max_nodes are aged, and it stops after max_ms milliseconds if that's not 0
+  //the rest stays queued, and is aged first by the next call
+  static void age_nodes( tree_state* state, octree_update_stats& us, unsigned max_nodes, float max_ms )
+  {
+    assert( is_setup );
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<octree<t>*> nodes;
+    nodes.swap( state->aging );
+
+    size_t i = 0;
+    for( ; i < nodes.size() && i < max_nodes; ++i )
+    {
+      //checking the clock is not free, so it's only done every few nodes
+      if( max_ms > 0 && i && !( i % 16 ) &&
+        std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - start ).count() > max_ms )
+        break;
+
+      octree<t>* n = nodes[i];
+      ++us.nodes_aged;
+
+      //still flagged as queued, so pulling up its own objects doesn't queue it again
+      if( n->merge_sparse_parents() )
+        ++us.merges;
+
+      n->is_aging = false;
+
+      if( n->get_object_count() )
+      {
+        if( n->life != -1 ) //got reused while dying, let it live longer next time
+        {
+          if( n->max_lifespan <= max_life_boundary )
+            n->max_lifespan *= 2;
+
+          n->life = -1;
+        }
+
+        //compact the dynamic list once most of it has left
+        if( n->objects.capacity() > 2 * n->objects.size() + 4 )
+        {
+          std::vector<t>( n->objects ).swap( n->objects );
+
+          if( n->nb )
+            std::vector<object_bounds>( n->nb->objects ).swap( n->nb->objects );
+        }
+
+        continue;
+      }
+
+      if( n->has_children() )
+        continue;
+
+      if( n->life == -1 )
+        n->life = n->max_lifespan;
+      else if( n->life > 0 )
+        --n->life;
+
+      if( !n->life && n != *state->root_ptr )
+      {
+        octree<t>* p = n->parent;
+
+        if( p ) //roots that were cut off have no parent
+        {
+          for( int c = 0; c < 8; ++c )
+            if( p->is_child_active( c ) && p->children[c] == n )
+              p->clear_child( c ); //remove dead branch from octree
+
+          p->queue_aging(); //might have become an empty leaf
+          p->own_epoch = std::max( p->own_epoch, n->own_epoch ); //the parent covers the changes of the freed node from now on
+        }
+
+        delete n;
+        ++us.nodes_freed;
+      }
+      else if( n->life )
+        n->queue_aging();
+    }
+
+    //the nodes that didn't fit into the budget go first next time
+    if( i < nodes.size() )
+    {
+      nodes.erase( nodes.begin(), nodes.begin() + i );
+      nodes.insert( nodes.end(), state->aging.begin(), state->aging.end() );
+      nodes.swap( state->aging );
+    }
+
+    us.nodes_pending = unsigned( state->aging.size() );
+  }
+
+  void set_child( unsigned c, octree<t>* n )
+  {
+    if( !children )
+    {
+      children = new octree<t>*[8];
+      std::fill( children, children + 8, ( octree<t>* )0 );
+    }
+
+    children[c] = n;
+    active_children |= ( 1 << c );
+  }
+
+  //frees the child pointers with the last child
+  void clear_child( unsigned c )
+  {
+    children[c] = 0;
+    active_children &= ~( 1 << c );
+
+    if( !active_children )
+    {
+      delete[] children;
+      children = 0;
+    }
+  }
+
+  bool is_child_active( unsigned c )
+  {
+    assert( is_setup );
+
+    return active_children & ( 1 << c );
+  }
+
+  bool is_leaf()
+  {
+    assert( is_setup );
+
+    return get_object_count() == 1;
+  }
+
+  bool is_root()
+  {
+    assert( is_setup );
+
+    return !parent;
+  }
+
+  bool has_children()
+  {
+    assert( is_setup );
+
+    return active_children;
+  }
+
+  bool is_empty()
+  {
+    assert( is_setup );
+
+    if( get_object_count() ) //we have objects in this node
+    {
+      return false;
+    }
+    else
+    {
+      //check child nodes recursively
+      for( int c = 0; c < 8; ++c )
+      {
+        if( is_child_active( c ) && !children[c]->is_empty() )
+          return false;
+      }
+
+      return true;
+    }
+  }
+
+  void delete_subtree()
+  {
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->delete_subtree();
+
+    delete this;
+  }
+
+  void collect_stats( octree_stats& s, unsigned depth )
+  {
+    unsigned d = depth < octree_stats::max_depth ? depth : octree_stats::max_depth - 1;
+    unsigned active = 0;
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) ) ++active;
+
+    s.depth = std::max( s.depth, depth + 1 );
+    ++s.node_count;
+    ++s.nodes_per_depth[d];
+    unsigned count = unsigned( get_object_count() );
+
+    s.object_count += count;
+    s.static_object_count += unsigned( static_objects.size() );
+    s.objects_per_depth[d] += count;
+    s.node_bytes += sizeof( octree<t> ) + ( children ? 8 * sizeof( octree<t>* ) : 0 ) + ( nb ? sizeof( node_bounds ) : 0 );
+    s.object_bytes += ( objects.capacity() + static_objects.capacity() ) * sizeof( t ) + ( nb ? nb->objects.capacity() * sizeof( object_bounds ) : 0 );
+
+    if( !count )
+      ++s.empty_node_count;
+
+    if( active )
+    {
+      s.straddler_count += count;
+      s.straddlers_per_depth[d] += count;
+      s.child_fill += active / 8.0f;
+    }
+    else
+    {
+      ++s.leaf_count;
+
+      if( !count && life > 0 )
+        ++s.dying_node_count;
+    }
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->collect_stats( s, depth + 1 );
+  }
+
+  //emits every object of the subtree without testing anything
+  //children are visited in the order first, first ^ 1, ..., first ^ 7, after the objects of the node unless objects_last
+  void get_all_objects( std::vector<t>& objs, octree_query_stats* qs, unsigned first = 0, bool objects_last = false )
+  {
+    OCTREE_ADD( qs, objects_emitted, get_object_count() );
+
+    if( !objects_last )
+    {
+      objs.insert( objs.end(), static_objects.begin(), static_objects.end() );
+      objs.insert( objs.end(), objects.begin(), objects.end() );
+    }
+
+    for( unsigned i = 0; i < 8; ++i )
+    {
+      unsigned c = i ^ first;
+
+      if( is_child_active( c ) )
+      {
+        OCTREE_COUNT( qs, nodes_visited );
+        children[c]->get_all_objects( objs, qs, first, objects_last );
+      }
+    }
+
+    if( objects_last )
+    {
+      objs.insert( objs.end(), static_objects.begin(), static_objects.end() );
+      objs.insert( objs.end(), objects.begin(), objects.end() );
+    }
+  }
+
+  //flattens the subtree of this node breadth first, stopping at page_depth
+  //nodes at page_depth are flagged as paged and their subtree roots are collected instead
+  void flatten( std::vector<octree<t>*>& order, std::vector<octree_file::node>& nodes, uint64_t& object_count,
+    unsigned page_depth = ~0u, std::vector<octree<t>*>* paged_roots = 0 )
+  {
+    std::vector<unsigned> depths;
+    std::vector<aabb> bvs;
+    order.push_back( this );
+    depths.push_back( 0 );
+    bvs.push_back( get_bv() );
+
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+      octree<t>* n = order[i];
+
+      octree_file::node fn = {};
+      for( int c = 0; c < 3; ++c )
+      {
+        fn.min[c] = bvs[i].min[c];
+        fn.max[c] = bvs[i].max[c];
+      }
+
+      if( depths[i] == page_depth )
+      {
+        fn.flags = octree_file::PAGED;
+        fn.first_child = unsigned( paged_roots->size() );
+        paged_roots->push_back( n );
+        nodes.push_back( fn );
+        continue;
+      }
+
+      fn.first_child = unsigned( order.size() );
+      fn.first_object = object_count;
+      fn.object_count = unsigned( n->get_object_count() );
+      fn.active_children = n->active_children;
+      nodes.push_back( fn );
+
+      object_count += n->get_object_count();
+
+      for( int c = 0; c < 8; ++c )
+        if( n->is_child_active( c ) )
+        {
+          order.push_back( n->children[c] );
+          depths.push_back( depths[i] + 1 );
+          bvs.push_back( get_child_bv( bvs[i], c ) );
+        }
+    }
+  }
+
+  static void write_objects( std::ostream& f, const std::vector<octree<t>*>& order, const std::vector<octree_file::node>& nodes )
+  {
+    for( size_t c = 0; c < order.size(); ++c )
+      if( !( nodes[c].flags & octree_file::PAGED ) )
+      {
+        const std::vector<t>& s = order[c]->static_objects;
+        const std::vector<t>& d = order[c]->objects;
+
+        if( !s.empty() )
+          f.write( ( const char* )s.data(), s.size() * sizeof( t ) );
+
+        if( !d.empty() )
+          f.write( ( const char* )d.data(), d.size() * sizeof( t ) );
+      }
+  }
+
+  static void write_padding( std::ostream& f, uint64_t size )
+  {
+    static const char padding[256] = {};
+
+    for( ; size > sizeof( padding ); size -= sizeof( padding ) )
+      f.write( padding, sizeof( padding ) );
+
+    f.write( padding, size );
+  }
+
+  //recomputes tight for the nodes that changed below this one, bottom up, bv is the bounds of this node
+  void refit( const aabb& bv )
+  {
+    node_bounds& nbs = get_node_bounds();
+
+    if( nbs.is_own_refit_pending )
+    {
+      nbs.own = get_empty_bounds();
+
+      if( state->settings.object_bounds )
+      {
+        for( auto& q : nbs.objects )
+          merge( nbs.own, q );
+      }
+      else
+      {
+        for( auto& o : static_objects )
+          merge( nbs.own, quantize( get_placed_bounds( o, state->index[o] ), bv ) );
+
+        for( auto& o : objects )
+          merge( nbs.own, quantize( get_placed_bounds( o, state->index[o] ), bv ) );
+      }
+
+      nbs.is_own_refit_pending = false;
+    }
+
+    object_bounds b = nbs.own;
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+      {
+        octree<t>* n = children[c];
+
+        if( n->is_refit_pending() )
+          n->refit( get_child_bv( bv, c ) );
+
+        if( !is_empty( n->nb->tight ) )
+          merge( b, get_parent_bounds( n->nb->tight, c ) );
+      }
+
+    nbs.tight = b;
+    nbs.is_refit_pending = false;
+  }
+
+  //bounds that queries test this node with, bv is its cell
+  //returns false if the subtree is known to be empty
+  bool get_query_bounds( const aabb& bv, aabb& b )
+  {
+    if( !state->settings.tight_bounds || is_refit_pending() )
+    {
+      b = bv;
+      return true;
+    }
+
+    if( is_empty( nb->tight ) )
+      return false;
+
+    b = dequantize( nb->tight, bv );
+    return true;
+  }
+
+  //obv is stored with the object, pbv is the bounds it is placed with, bv is the bounds of this node
+  void place( const t& o, shape* obv, shape* pbv, aabb bv )
+  {
+    assert( is_setup );
+
+    //check if shape fits, if not the octree should be extended
+    if( pbv->is_inside( &bv ) )
+    {
+      //min node size is 1, so if the object fits, and the node has the minimum size, then insert here, and return
+      //no further subdividing is allowed
+      //also if the node contains less than 3 objects than insert here
+      //no further subdividing is required
+      if( bv.max.x - bv.min.x <= 1 || get_object_count() < 3 )
+      {
+        store_object( o, obv, pbv, bv );
+        return;
+      }
+
+      bool found = false;
+      for( int c = 0; c < 8; ++c )
+      {
+        //try to fit the object into one of the octants
+        aabb cbv = get_child_bv( bv, c );
+
+        if( pbv->is_inside( &cbv ) )
+        {
+          if( !is_child_active( c ) )
+          {
+            set_child( c, new octree<t>() ); //activate this node
+            children[c]->state = state;
+            children[c]->octant = c;
+            children[c]->parent = this;
+          }
+
+          //this will make sure we're inserting into the smallest possible octant down the tree
+          children[c]->place( o, obv, pbv, cbv ); //insert into child node (recursively)
+
+          found = true;
+          break; //an object is only stored once
+        }
+      }
+
+      if( !found ) //didn't fit into any subnode
+      {
+        store_object( o, obv, pbv, bv );
+      }
+    }
+    else
+    {
+      if( is_root() )
+      {
+        ( *state->root_ptr )->expand_octree( pbv );
+        ( *state->root_ptr )->place( o, obv, pbv, state->root_bv );
+      }
+      else
+        ; //not a root node, stop recursion here
+    }
+  }
+
+  //i indexes bounds, bv is the bounds of this node
+  bool is_object_visible( size_t i, const aabb& bv, shape* f, octree_query_stats* qs )
+  {
+    if( state->settings.object_bounds )
+    {
+      aabb b = dequantize( nb->objects[i], bv );
+
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( !b.is_intersecting( f ) )
+      {
+        OCTREE_COUNT( qs, objects_rejected );
+        return false;
+      }
+    }
+
+    OCTREE_COUNT( qs, objects_emitted );
+    return true;
+  }
+
+  //tests the objects of a node that is partially inside f one by one, on their quantized bounds, and calls emit for the visible ones
+  //boxes, spheres and frustums are moved into the integer space of the cell once, instead of converting every object back
+  template< class func >
+  void visit_visible_objects( const aabb& bv, shape* f, octree_query_stats* qs, const func& emit )
+  {
+    if( !get_object_count() )
+      return; //nothing was quantized, nb might not even exist
+
+    const std::vector<object_bounds>& bounds = nb->objects;
+    assert( bounds.size() == get_object_count() );
+
+    int type = f->get_class_index();
+    bool is_box = type == aabb::get_class_idx() || type == sphere::get_class_idx();
+    bool is_frustum = type == frustum::get_class_idx();
+
+    object_bounds fq = {};
+    if( is_box )
+      fq = quantize( f, bv );
+
+    //n . q + offset is the signed distance from the plane in steps
+    float normals[6][3], offsets[6];
+    if( is_frustum )
+    {
+      frustum* fr = static_cast<frustum*>( f );
+      float step = ( bv.max.x - bv.min.x ) / 65535;
+
+      for( int p = 0; p < 6; ++p )
+      {
+        mm::vec3 n = fr->planes[p].get_normal();
+
+        for( int c = 0; c < 3; ++c )
+          normals[p][c] = n[c];
+
+        offsets[p] = ( fr->planes[p].get_minus_n_dot_p() + mm::dot( n, bv.min ) ) / step;
+      }
+    }
+
+    size_t static_count = static_objects.size();
+
+    for( size_t c = 0; c < bounds.size(); ++c )
+    {
+      if( !is_box && !is_frustum )
+      {
+        if( is_object_visible( c, bv, f, qs ) )
+          emit( c < static_count ? static_objects[c] : objects[c - static_count] );
+
+        continue;
+      }
+
+      const object_bounds& q = bounds[c];
+      bool visible = true;
+
+      if( is_box )
+        visible = is_overlapping( q, fq );
+      else
+      {
+        //the corner furthest along the normal has to be in front of every plane
+        for( int p = 0; p < 6 && visible; ++p )
+          visible = normals[p][0] * ( normals[p][0] > 0 ? q.max[0] : q.min[0] ) +
+            normals[p][1] * ( normals[p][1] > 0 ? q.max[1] : q.min[1] ) +
+            normals[p][2] * ( normals[p][2] > 0 ? q.max[2] : q.min[2] ) + offsets[p] >= 0;
+      }
+
+      if( !visible )
+      {
+        OCTREE_COUNT( qs, objects_rejected );
+        continue;
+      }
+
+      OCTREE_COUNT( qs, objects_emitted );
+      emit( c < static_count ? static_objects[c] : objects[c - static_count] );
+    }
+  }
+
+  void get_visible_objects( const aabb& bv, std::vector<t>& objs, shape* f, octree_query_stats* qs )
+  {
+    visit_visible_objects( bv, f, qs, [&]( const t& o )
+    {
+      objs.push_back( o );
+    } );
+  }
+
+  static void set_visible( std::vector<bool>& visible, const t& o )
+  {
+    if( size_t( o ) >= visible.size() )
+      visible.resize( size_t( o ) + 1, false );
+
+    visible[size_t( o )] = true;
+  }
+
+  //like get_all_objects, for get_visibility
+  void set_all_visible( std::vector<bool>& visible, octree_query_stats* qs )
+  {
+    OCTREE_ADD( qs, objects_emitted, get_object_count() );
+
+    for( auto& o : static_objects )
+      set_visible( visible, o );
+
+    for( auto& o : objects )
+      set_visible( visible, o );
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+      {
+        OCTREE_COUNT( qs, nodes_visited );
+        children[c]->set_all_visible( visible, qs );
+      }
+  }
+
+  //nodes are rejected like in get_culled_objects, the root included, so the two always agree
+  bool is_in_frustum( const aabb& bv, const t& o, shape* f, octree_query_stats* qs )
+  {
+    aabb b;
+
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    if( !get_query_bounds( bv, b ) || !b.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return false;
+    }
+
+    for( size_t c = 0; c < static_objects.size(); ++c )
+      if( static_objects[c] == o )
+        return is_object_visible( c, bv, f, qs );
+
+    for( size_t c = 0; c < objects.size(); ++c )
+      if( objects[c] == o ) //is this the droid you're looking for?
+      {
+        return is_object_visible( static_objects.size() + c, bv, f, qs ); //found the object
+        /*
+        if((&bv)->intersects(f)) //is it in yet?
+        return 1; //in
+        else
+        return 0; //culled
+        */
+      }
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) && children[c]->is_in_frustum( get_child_bv( bv, c ), o, f, qs ) )
+        return true;
+
+    return false;
+  }
+
+  //first and objects_last order the output like in get_all_objects
+  void get_culled_objects( const aabb& bv, std::vector<t>& objs, shape* f, octree_query_stats* qs, unsigned first = 0, bool objects_last = false )
+  {
+    aabb b;
+
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    if( !get_query_bounds( bv, b ) || !b.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    //if the node is completely inside, so are its children
+    if( b.can_be_inside( f ) )
+    {
+      OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+
+      if( b.is_inside( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_accepted_fully );
+        get_all_objects( objs, qs, first, objects_last );
+        return;
+      }
+    }
+
+    OCTREE_COUNT( qs, nodes_accepted_partially );
+
+    if( !objects_last )
+      get_own_objects( bv, objs, f, qs );
+
+    for( unsigned i = 0; i < 8; ++i )
+    {
+      unsigned c = i ^ first;
+
+      if( is_child_active( c ) )
+        children[c]->get_culled_objects( get_child_bv( bv, c ), objs, f, qs, first, objects_last );
+    }
+
+    if( objects_last )
+      get_own_objects( bv, objs, f, qs );
+  }
+
+  //the same traversal as get_culled_objects, setting the bits of the objects instead of collecting them
+  void get_visibility( const aabb& bv, std::vector<bool>& visible, shape* f, octree_query_stats* qs )
+  {
+    aabb b;
+
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    if( !get_query_bounds( bv, b ) || !b.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    if( b.can_be_inside( f ) )
+    {
+      OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+
+      if( b.is_inside( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_accepted_fully );
+        set_all_visible( visible, qs );
+        return;
+      }
+    }
+
+    OCTREE_COUNT( qs, nodes_accepted_partially );
+
+    if( state->settings.object_bounds )
+      visit_visible_objects( bv, f, qs, [&]( const t& o )
+      {
+        set_visible( visible, o );
+      } );
+    else
+    {
+      OCTREE_ADD( qs, objects_emitted, get_object_count() );
+
+      for( auto& o : static_objects )
+        set_visible( visible, o );
+
+      for( auto& o : objects )
+        set_visible( visible, o );
+    }
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->get_visibility( get_child_bv( bv, c ), visible, f, qs );
+  }
+
+  //is_inside is set once an ancestor was found to be completely inside f, then only the sizes are tested
+  void get_culled_objects( const aabb& bv, std::vector<t>& objs, std::vector<unsigned char>& lods, shape* f,
+    const octree_screen_query& sq, octree_query_stats* qs, bool is_inside )
+  {
+    aabb b;
+
+    OCTREE_COUNT( qs, nodes_visited );
+
+    if( !get_query_bounds( bv, b ) || sq.get_pixels( b ) < sq.min_pixels )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    if( !is_inside )
+    {
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( !b.is_intersecting( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_rejected );
+        return;
+      }
+
+      if( b.can_be_inside( f ) )
+      {
+        OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+        is_inside = b.is_inside( f );
+      }
+    }
+
+    if( is_inside )
+    {
+      OCTREE_COUNT( qs, nodes_accepted_fully );
+    }
+    else
+    {
+      OCTREE_COUNT( qs, nodes_accepted_partially );
+    }
+
+    size_t static_count = static_objects.size();
+
+    for( size_t c = 0; c < get_object_count(); ++c )
+    {
+      const t& o = c < static_count ? static_objects[c] : objects[c - static_count];
+
+      //the quantized bounds spare a lookup, and are tested against f too
+      aabb ob = state->settings.object_bounds ? dequantize( nb->objects[c], bv ) : get_bounds( state->index[o].bv );
+      float pixels = sq.get_pixels( ob );
+
+      if( pixels < sq.min_pixels || ( state->settings.object_bounds && !is_inside && !ob.is_intersecting( f ) ) )
+      {
+        OCTREE_COUNT( qs, objects_rejected );
+        continue;
+      }
+
+      OCTREE_COUNT( qs, objects_emitted );
+      objs.push_back( o );
+      lods.push_back( ( unsigned char )sq.get_lod( pixels ) );
+    }
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->get_culled_objects( get_child_bv( bv, c ), objs, lods, f, sq, qs, is_inside );
+  }
+
+  enum node_visibility
+  {
+    culled = 0, partial, inside, unknown
+  };
+
+  //vis is forced on the children of culled and inside nodes
+  void update_visible_set( const aabb& bv, octree_visible_set<t>& vs, shape* f, octree_query_stats* qs, node_visibility vis )
+  {
+    OCTREE_COUNT( qs, nodes_visited );
+
+    if( vis == unknown )
+    {
+      aabb b;
+
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( !get_query_bounds( bv, b ) || !b.is_intersecting( f ) )
+        vis = culled;
+      else
+      {
+        vis = partial;
+
+        if( b.can_be_inside( f ) )
+        {
+          OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+
+          if( b.is_inside( f ) )
+            vis = inside;
+        }
+      }
+    }
+
+    unsigned char& last = vs.node_states[this];
+
+    //nothing changed in the subtree since the last update, and it's still completely in or out, so its objects are too
+    if( last == vis + 1 && vis != partial && epoch <= vs.epoch )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    last = vis + 1; //0 is a node that was never seen
+
+    vs.scratch.clear();
+
+    if( vis == inside )
+    {
+      vs.scratch.insert( vs.scratch.end(), static_objects.begin(), static_objects.end() );
+      vs.scratch.insert( vs.scratch.end(), objects.begin(), objects.end() );
+    }
+    else if( vis == partial )
+      get_own_objects( bv, vs.scratch, f, qs );
+
+    //scratch is in the order of the objects of the node
+    size_t k = 0, static_count = static_objects.size();
+
+    for( size_t c = 0; c < get_object_count(); ++c )
+    {
+      const t& o = c < static_count ? static_objects[c] : objects[c - static_count];
+      bool is_visible = k < vs.scratch.size() && vs.scratch[k] == o;
+
+      if( is_visible )
+      {
+        ++k;
+
+        if( vs.visible.insert( o ).second )
+          vs.entered.push_back( o );
+      }
+      else if( vs.visible.erase( o ) )
+        vs.exited.push_back( o );
+    }
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+        children[c]->update_visible_set( get_child_bv( bv, c ), vs, f, qs, vis == partial ? unknown : vis );
+  }
+
+  //collects at most max objects of the subtree, returns how many are still missing
+  unsigned get_representatives( std::vector<t>& reps, unsigned max )
+  {
+    for( size_t c = 0; c < static_objects.size() && max; ++c, --max )
+      reps.push_back( static_objects[c] );
+
+    for( size_t c = 0; c < objects.size() && max; ++c, --max )
+      reps.push_back( objects[c] );
+
+    for( int c = 0; c < 8 && max; ++c )
+      if( is_child_active( c ) )
+        max = children[c]->get_representatives( reps, max );
+
+    return max;
+  }
+
+  //a node on the border of a cut, it stands for its subtree as a proxy unless it gets refined
+  struct cut_entry
+  {
+    float pixels; //the error of drawing it as a proxy
+    octree* node;
+    aabb bv;
+    aabb b; //what it is seen by
+    bool is_inside;
+
+    bool operator<( const cut_entry& other ) const
+    {
+      return pixels < other.pixels;
+    }
+  };
+
+  //culls a node for get_cut, b and pixels are its bounds and projected size when it passes
+  bool is_in_cut( const aabb& bv, aabb& b, float& pixels, shape* f, const octree_screen_query& sq, octree_query_stats* qs, bool& is_inside )
+  {
+    OCTREE_COUNT( qs, nodes_visited );
+
+    if( !subtree_count || !get_query_bounds( bv, b ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return false;
+    }
+
+    pixels = sq.get_pixels( b );
+
+    if( pixels < sq.min_pixels )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return false;
+    }
+
+    if( !is_inside )
+    {
+      OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+      if( !b.is_intersecting( f ) )
+      {
+        OCTREE_COUNT( qs, nodes_rejected );
+        return false;
+      }
+
+      if( b.can_be_inside( f ) )
+      {
+        OCTREE_COUNT( qs, containment_tests[f->get_class_index()] );
+        is_inside = b.is_inside( f );
+      }
+    }
+
+    return true;
+  }
+
+  //adds a node that passed is_in_cut to the border of the cut
+  //a single object is just drawn, and a node around the eye can't be stood for by anything, these are refined right away
+  void add_to_cut( const cut_entry& e, octree_cut<t>& cut, std::vector<cut_entry>& border, double& error,
+    shape* f, const octree_screen_query& sq, octree_query_stats* qs )
+  {
+    if( subtree_count > 1 && e.pixels < std::numeric_limits<float>::max() )
+    {
+      border.push_back( e );
+      std::push_heap( border.begin(), border.end() );
+      error += e.pixels;
+    }
+    else
+      refine_cut( e.bv, cut, border, error, f, sq, qs, e.is_inside );
+  }
+
+  //replaces a node of the border by its own objects and its children
+  void refine_cut( const aabb& bv, octree_cut<t>& cut, std::vector<cut_entry>& border, double& error,
+    shape* f, const octree_screen_query& sq, octree_query_stats* qs, bool is_inside )
+  {
+    OCTREE_COUNT( qs, nodes_accepted_partially );
+
+    if( is_inside )
+    {
+      OCTREE_ADD( qs, objects_emitted, get_object_count() );
+
+      cut.objects.insert( cut.objects.end(), static_objects.begin(), static_objects.end() );
+      cut.objects.insert( cut.objects.end(), objects.begin(), objects.end() );
+    }
+    else
+      get_own_objects( bv, cut.objects, f, qs );
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) )
+      {
+        cut_entry e;
+        e.node = children[c];
+        e.bv = get_child_bv( bv, c );
+        e.is_inside = is_inside;
+
+        if( e.node->is_in_cut( e.bv, e.b, e.pixels, f, sq, qs, e.is_inside ) )
+          e.node->add_to_cut( e, cut, border, error, f, sq, qs );
+      }
+  }
+
+  //objects of a node that is partially inside f
+  void get_own_objects( const aabb& bv, std::vector<t>& objs, shape* f, octree_query_stats* qs )
+  {
+    if( state->settings.object_bounds )
+      get_visible_objects( bv, objs, f, qs );
+    else
+    {
+      OCTREE_ADD( qs, objects_emitted, get_object_count() );
+
+      objs.insert( objs.end(), static_objects.begin(), static_objects.end() );
+      objs.insert( objs.end(), objects.begin(), objects.end() );
+    }
+  }
+
+  void get_changed_nodes( const aabb& bv, std::vector<aabb>& boxes, shape* f, unsigned since, octree_query_stats* qs )
+  {
+    OCTREE_COUNT( qs, nodes_visited );
+    OCTREE_COUNT( qs, intersection_tests[f->get_class_index()] );
+
+    //the whole cell, objects that left the node are no longer in its tight bounds
+    aabb b = bv;
+    if( !b.is_intersecting( f ) )
+    {
+      OCTREE_COUNT( qs, nodes_rejected );
+      return;
+    }
+
+    if( own_epoch > since )
+      boxes.push_back( bv );
+
+    for( int c = 0; c < 8; ++c )
+      if( is_child_active( c ) && children[c]->epoch > since )
+        children[c]->get_changed_nodes( get_child_bv( bv, c ), boxes, f, since, qs );
+  }
+
+  static void push_trigger_event( std::vector<octree_trigger_event<t> >& events, const t& trigger, const t& o, typename octree_trigger_event<t>::event_type type )
+  {
+    octree_trigger_event<t> e;
+    e.trigger = trigger;
+    e.object = o;
+    e.type = type;
+    events.push_back( e );
+  }
+
+  //the objects of the tree that overlap the volume, or the triggers that overlap it when the tree is a trigger tree
+  //nodes only give the candidates, the exact test is on the shapes
+  void get_overlapping( shape* volume, std::vector<t>& objs )
+  {
+    objs.clear();
+    get_culled_objects( objs, volume );
+
+    size_t k = 0;
+    for( size_t c = 0; c < objs.size(); ++c )
+      if( volume->is_intersecting( state->index[objs[c]].bv ) )
+        objs[k++] = objs[c];
+
+    objs.resize( k );
+  }
+
+  //drops trigger from the contacts of o
+  static void erase_trigger_contact( tree_state* state, const t& trigger, const t& o )
+  {
+    auto it = state->trigger_contacts.find( o );
+    if( it == state->trigger_contacts.end() )
+      return;
+
+    std::vector<t>& contacts = it->second;
+    auto c = std::find( contacts.begin(), contacts.end(), trigger );
+    if( c != contacts.end() )
+      contacts.erase( c );
+
+    if( contacts.empty() )
+      state->trigger_contacts.erase( it );
+  }
+
+  //drops o from the objects of trigger
+  static void erase_trigger_object( tree_state* state, const t& trigger, const t& o )
+  {
+    auto it = state->trigger_objects.find( trigger );
+    if( it == state->trigger_objects.end() )
+      return;
+
+    it->second.erase( o );
+
+    if( it->second.empty() )
+      state->trigger_objects.erase( it );
+  }
+
+  //reports the events of the objects and triggers that were inserted or moved, and the removals since the last update
+  //objects resting in a trigger that didn't move produce no events
+  static void update_triggers( tree_state* state )
+  {
+    typedef octree_trigger_event<t> event;
+
+    state->trigger_events.swap( state->pending_trigger_events );
+    state->pending_trigger_events.clear();
+
+    if( !state->trigger_root )
+      return;
+
+    std::vector<t> found;
+    std::unordered_set<t> checked, changed;
+
+    for( auto& o : state->trigger_checks )
+    {
+      auto it = state->index.find( o );
+      if( it == state->index.end() || !checked.insert( o ).second ) //removed since, or moved twice
+        continue;
+
+      state->trigger_root->get_overlapping( it->second.bv, found );
+
+      std::vector<t>& contacts = state->trigger_contacts[o];
+
+      for( auto& c : found )
+        if( std::find( contacts.begin(), contacts.end(), c ) != contacts.end() )
+          push_trigger_event( state->trigger_events, c, o, event::stay );
+        else
+        {
+          push_trigger_event( state->trigger_events, c, o, event::enter );
+          state->trigger_objects[c].insert( o );
+        }
+
+      for( auto& c : contacts )
+        if( std::find( found.begin(), found.end(), c ) == found.end() )
+        {
+          push_trigger_event( state->trigger_events, c, o, event::exit );
+          erase_trigger_object( state, c, o );
+        }
+
+      if( found.empty() )
+        state->trigger_contacts.erase( o );
+      else
+        contacts.swap( found );
+    }
+
+    //the objects checked above already saw the triggers at their new place
+    for( auto& trigger : state->changed_triggers )
+    {
+      auto it = state->trigger_root->state->index.find( trigger );
+      if( it == state->trigger_root->state->index.end() || !changed.insert( trigger ).second )
+        continue;
+
+      ( *state->root_ptr )->get_overlapping( it->second.bv, found );
+
+      std::unordered_set<t> inside;
+      for( auto& o : found )
+        if( !checked.count( o ) )
+          inside.insert( o );
+
+      std::unordered_set<t>& objs = state->trigger_objects[trigger];
+
+      for( auto i = objs.begin(); i != objs.end(); )
+      {
+        const t& o = *i;
+
+        if( checked.count( o ) )
+          ++i;
+        else if( inside.erase( o ) )
+        {
+          push_trigger_event( state->trigger_events, trigger, o, event::stay );
+          ++i;
+        }
+        else
+        {
+          push_trigger_event( state->trigger_events, trigger, o, event::exit );
+          erase_trigger_contact( state, trigger, o );
+          i = objs.erase( i );
+        }
+      }
+
+      for( auto& o : inside )
+      {
+        push_trigger_event( state->trigger_events, trigger, o, event::enter );
+        state->trigger_contacts[o].push_back( trigger );
+        objs.insert( o );
+      }
+
+      if( objs.empty() )
+        state->trigger_objects.erase( trigger );
+    }
+
+    state->trigger_checks.clear();
+    state->changed_triggers.clear();
+
+    state->trigger_root->update(); //ages the nodes the triggers left
+  }
+
+  void get_boxes( const aabb& bv, std::vector<aabb>& boxes )
+  {
+    boxes.push_back( bv );
+
+    for( int c = 0; c < 8; ++c )
+    {
+      if( is_child_active( c ) )
+      {
+        children[c]->get_boxes( get_child_bv( bv, c ), boxes );
+      }
+    }
+  }
+
+public:
+
+  void reposition_object( const t& o, shape* obv )
+  {
+    assert( is_setup );
+
+    auto it = state->index.find( o );
+    if( it != state->index.end() )
+    {
+      it->second.bv = obv;
+      it->second.node->reposition( o, it->second );
+    }
+  }
+
+  //objects are placed by their bounds grown by margin, and swept along their velocity for lookahead frames
+  //they are only reinserted once their real bounds escape the enlarged ones
+  //trades some culling precision for less reinsertions of moving objects, 0 turns it off
+  //like all settings it can only be changed while the tree is empty, returns false otherwise
+  bool set_fat_bounds( float margin, float lookahead = 0 )
+  {
+    assert( is_setup );
+
+    if( !state->index.empty() )
+      return false;
+
+    state->settings.fat_margin = margin;
+    state->settings.fat_lookahead = lookahead;
+    return true;
+  }
+
+  //once a subtree holds threshold objects or less they are pulled up into its root during aging,
+  //and the emptied children die, which keeps sparse regions shallow, 0 turns it off
+  bool set_merge_threshold( unsigned threshold )
+  {
+    assert( is_setup );
+
+    if( !state->index.empty() )
+      return false;
+
+    state->settings.merge_threshold = threshold;
+    return true;
+  }
+
+  //distance the object moves per frame, used to sweep its enlarged bounds
+  void set_velocity( const t& o, const mm::vec3& velocity )
+  {
+    assert( is_setup );
+
+    if( state->settings.fat_lookahead > 0 && state->index.count( o ) )
+      state->velocities[o] = velocity;
+  }
+
+  //the object will be repositioned by the next update, using the bv it was inserted with
+  void mark_dirty( const t& o )
+  {
+    assert( is_setup );
+
+    state->dirty.push_back( o );
+  }
+
+  void mark_dirty( const t& o, shape* obv )
+  {
+    assert( is_setup );
+
+    auto it = state->index.find( o );
+    if( it != state->index.end() )
+      it->second.bv = obv;
+
+    state->dirty.push_back( o );
+  }
+
+  //repositions the objects marked dirty, and ages the nodes they left
+  //static objects cost nothing here
+  //aging can be spread over several frames by giving it a budget of nodes and/or milliseconds
+  octree_update_stats update( unsigned max_nodes = ~0u, float max_ms = 0 )
+  {
+    assert( is_setup );
+
+    //this node might stop being the root, or even die while aging
+    tree_state* state = this->state;
+    octree_update_stats us;
+
+    for( auto& o : state->dirty )
+    {
+      auto it = state->index.find( o );
+      if( it != state->index.end() ) //might have been removed since it was marked
+      {
+        ++us.repositioned;
+
+        if( it->second.node->reposition( o, it->second ) )
+          ++us.reinserted;
       }
     }
-    else
+
+    if( state->trigger_root )
+      state->trigger_checks.insert( state->trigger_checks.end(), state->dirty.begin(), state->dirty.end() );
+
+    state->dirty.clear();
+
+    update_triggers( state );
+
+    age_nodes( state, us, max_nodes, max_ms );
+
+    octree<t>* root = *state->root_ptr;
+
+    unsigned counter = 0;
+    for( int c = 0; c < 8; ++c )
+      if( root->is_child_active( c ) ) ++counter;
+
+    //if the root doesn't contain any objects, and the
+    //a root sized by set_world_bounds only collapses while the child still encloses the world
+    if( !root->get_object_count() && counter == 1 )
     {
-      if( is_top )
-      {
-        if( is_back )
-        {
-          octant = 6;
-        }
-        else
+      octree<t>* active_node = 0;
+      for( int c = 0; c < 8; ++c )
+        if( root->is_child_active( c ) )
         {
-          octant = 2;
+          aabb cbv = get_child_bv( state->root_bv, c );
+
+          if( !state->has_world_bounds || state->world_bv.is_inside( &cbv ) )
+          {
+            active_node = root->children[c];
+            state->root_bv = cbv;
+          }
+
+          break;
         }
-      }
-      else
+
+      if( active_node )
       {
-        if( is_back )
-        {
-          octant = 4;
-        }
+        *state->root_ptr = active_node;
+        ( *state->root_ptr )->parent = 0;
+
+        //the old root is cut off, if it's queued the next aging pass frees it
+        root->clear_child( active_node->octant );
+
+        if( root->is_aging )
+          root->life = 0;
         else
-        {
-          octant = 0;
-        }
+          delete root;
       }
     }
 
-    auto newroot = new octree( aabb( bv.get_pos() + mm::vec3(
-      ( is_right ? bv.get_extents().x : -bv.get_extents().x ),
-      ( is_top ? bv.get_extents().y : -bv.get_extents().y ),
-      ( is_back ? bv.get_extents().z : -bv.get_extents().z )
-      ), extsize ) );
-    octree<t>* oldroot = *root_ptr;
-    newroot->children[octant] = this;
-    newroot->active_children |= ( 1 << octant );
-    *root_ptr = newroot;
-    oldroot->parent = *root_ptr;
+    root = *state->root_ptr;
+    if( state->settings.tight_bounds && root->is_refit_pending() )
+      root->refit( state->root_bv );
+
+    return us;
   }
 
-  octree* get_fitting_parent( const t& o, shape* obv )
+  //treats every object as moved
+  octree_update_stats update( const std::vector<std::pair<t, shape*> >& objs )
   {
     assert( is_setup );
 
-    if( obv->is_inside( &bv ) )
+    for( auto& c : objs )
     {
-      return this;
+      mark_dirty( c.first, c.second );
     }
-    else if( parent )
-      return parent->get_fitting_parent( o, obv );
-    else //this is the root node
-      return 0;
+
+    return update();
   }
 
-  void update_recursively()
+  bool remove( const t& o )
   {
     assert( is_setup );
 
-    if( !objects.size() )
+    auto it = state->index.find( o );
+    if( it == state->index.end() )
+      return false;
+
+    it->second.node->erase_object( o, it->second.is_static );
+    state->index.erase( it );
+    state->fat.erase( o );
+    state->velocities.erase( o );
+    ++state->removals;
+
+    auto contacts = state->trigger_contacts.find( o );
+    if( contacts != state->trigger_contacts.end() )
     {
-      if( !has_children() )
+      for( auto& c : contacts->second )
       {
-        if( life == -1 )
-          life = max_lifespan;
-        else if( life > 0 )
-          --life;
+        push_trigger_event( state->pending_trigger_events, c, o, octree_trigger_event<t>::exit );
+        erase_trigger_object( state, c, o );
       }
-    }
-    else
-    {
-      if( life != -1 )
-      {
-        if( max_lifespan <= 64 )
-          max_lifespan *= 2;
 
-        life = -1;
-      }
+      state->trigger_contacts.erase( contacts );
     }
 
-    for( int c = 0; c < 8; ++c )
-      if( is_child_active( c ) )
-      children[c]->update_recursively();
+    return true;
+  }
 
-    for( int c = 0; c < 8; ++c )
-      if( is_child_active( c ) && !children[c]->life )
-      {
-        //TODO we should delete the dead branch here
-        active_children ^= ( 1 << c ); //remove dead branch from octree
-        children[c] = 0;
-      }
+  bool is_in_frustum( const t& o, shape* f, octree_query_stats* qs = 0 )
+  {
+    assert( is_setup );
+
+    return is_in_frustum( get_bv(), o, f, qs );
   }
 
-  bool is_child_active( unsigned c )
+  void get_culled_objects( std::vector<t>& objs, shape* f, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    return active_children & ( 1 << c );
+    get_culled_objects( get_bv(), objs, f, qs );
   }
 
-  bool is_leaf()
+  //also culls the nodes and objects that would be smaller than sq.min_pixels on screen,
+  //and picks a lod for each object by its size, lods[c] is the lod of objs[c]
+  //objects are tested by their bounds, which is a lot cheaper with set_object_bounds on
+  void get_culled_objects( std::vector<t>& objs, std::vector<unsigned char>& lods, shape* f, const octree_screen_query& sq, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    return objects.size() == 1;
+    get_culled_objects( get_bv(), objs, lods, f, sq, qs, false );
   }
 
-  bool is_root()
+  //returns a cut through the tree, objects nearby one by one, and far away nodes as proxies
+  //the error of a proxy is its size on screen in pixels, starting from the root the proxy with the largest error is
+  //refined into its objects and children until the errors of all proxies add up to at most error_budget
+  //so a budget of 0 returns every object, and a large one just a few proxies near the root
+  //proxies are built from what the nodes keep up to date anyway, the object count of their subtree and their tight bounds,
+  //plus at most max_representatives of their objects gathered at the end
+  //nodes and objects smaller than sq.min_pixels are culled
+  void get_cut( octree_cut<t>& cut, shape* f, const octree_screen_query& sq, float error_budget, unsigned max_representatives = 1, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    return !parent;
+    std::vector<cut_entry> border; //a heap, largest error first
+    double error = 0; //of the border
+
+    cut_entry root;
+    root.node = this;
+    root.bv = get_bv();
+    root.is_inside = false;
+
+    if( is_in_cut( root.bv, root.b, root.pixels, f, sq, qs, root.is_inside ) )
+      add_to_cut( root, cut, border, error, f, sq, qs );
+
+    while( !border.empty() && error > error_budget )
+    {
+      std::pop_heap( border.begin(), border.end() );
+      cut_entry e = border.back();
+      border.pop_back();
+
+      error -= e.pixels;
+      e.node->refine_cut( e.bv, cut, border, error, f, sq, qs, e.is_inside );
+    }
+
+    for( size_t c = 0; c < border.size(); ++c )
+    {
+      typename octree_cut<t>::proxy p;
+      p.bounds = border[c].b;
+      p.object_count = border[c].node->subtree_count;
+      p.first_representative = unsigned( cut.representatives.size() );
+      border[c].node->get_representatives( cut.representatives, max_representatives );
+      p.representative_count = unsigned( cut.representatives.size() ) - p.first_representative;
+
+      cut.proxies.push_back( p );
+      OCTREE_COUNT( qs, nodes_accepted_fully );
+    }
   }
 
-  bool has_children()
+  //sets visible[o] for every object that get_culled_objects would return, and clears the rest
+  //costs a single cull that writes the bits directly, instead of searching the tree with is_in_frustum for every object
+  //objects have to be usable as indices, visible grows to hold the largest one found
+  void get_visibility( std::vector<bool>& visible, shape* f, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
+    static_assert( std::is_integral<t>::value, "visibility bitsets need integral object ids" );
 
-    return active_children;
+    std::fill( visible.begin(), visible.end(), false );
+    get_visibility( get_bv(), visible, f, qs );
   }
 
-  bool is_empty()
+  //changes whenever an object is inserted, removed or moved, or the tree grows
+  unsigned get_version() const
+  {
+    assert( is_setup );
+
+    return state->epoch;
+  }
+
+  //returns the cached result when the same query was made since the tree last changed, and caches it otherwise
+  //a cache follows a single tree, and assumes that the object bounds and tight bounds settings don't change
+  void get_culled_objects( std::vector<t>& objs, shape* f, octree_query_cache<t>& cache, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    if( !objects.empty() ) //we have objects in this node
+    if( !cache.set_key( f ) )
     {
-      return false;
+      ++cache.misses;
+      get_culled_objects( objs, f, qs );
+      return;
     }
+
+    typename octree_query_cache<t>::entry* e = cache.find( state->epoch );
+
+    if( e )
+      ++cache.hits;
     else
     {
-      //check child nodes recursively
-      for( int c = 0; c < 8; ++c )
-      {
-        if( is_child_active( c ) && !children[c]->is_empty() )
-          return false;
-      }
-
-      return true;
+      ++cache.misses;
+      e = &cache.claim( state->epoch );
+      get_culled_objects( e->objects, f, qs );
     }
-  }
 
-public:
+    objs.insert( objs.end(), e->objects.begin(), e->objects.end() );
+  }
 
-  void reposition_object( const t& o, shape* obv )
+  //reports the objects that entered or left f since the previous update of vs
+  //subtrees that didn't change since then, and are still completely inside or outside f, are skipped
+  //only nodes that are partially inside f, or changed, or were reclassified are visited
+  //a visible set follows a single tree
+  void update_visible_set( octree_visible_set<t>& vs, shape* f, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    for( auto i = objects.begin(); i != objects.end(); ++i )
-      if( *i == o ) //is this the one we're looking for?
-      {
-        if( !obv->is_inside( &bv ) ) //doesnt fit anymore, need to reposition
-        {
-          objects.erase( i );
+    vs.entered.clear();
+    vs.exited.clear();
 
-          if( parent )
-          {
-            auto c = parent->get_fitting_parent( o, obv );
-            if( c )
-              c->insert( o, obv ); //try to insert it as far down as possible
-            else
-            {
-              ( *root_ptr )->expand_octree( obv );
-              ( *root_ptr )->insert( o, obv );
-            }
-          }
-          else
-          {
-            ( *root_ptr )->expand_octree( obv );
-            ( *root_ptr )->insert( o, obv );
-          }
+    //states of freed nodes would pile up otherwise, forgetting them only costs a full traversal
+    if( vs.node_states.size() > 2 * size_t( allocated_nodes ) + 64 )
+      vs.node_states.clear();
+
+    update_visible_set( get_bv(), vs, f, qs, unknown );
+
+    //removed objects can't be found in the tree any more
+    if( vs.removals != state->removals )
+    {
+      for( auto i = vs.visible.begin(); i != vs.visible.end(); )
+        if( !state->index.count( *i ) )
+        {
+          vs.exited.push_back( *i );
+          i = vs.visible.erase( i );
         }
         else
-          ; //object still fits, nothing to do
+          ++i;
 
-        return;
-      }
+      vs.removals = state->removals;
+    }
 
-    //recursively check children
-    for( int c = 0; c < 8; ++c )
-      if( is_child_active( c ) )
-      children[c]->reposition_object( o, obv );
+    vs.epoch = state->epoch;
   }
 
-  void update( const std::vector<std::pair<t, shape*> >& objs )
+  //emits the objects roughly front to back along view_dir, at no extra cost
+  //the children nearest to the viewer are visited first, the octant order follows from the signs of view_dir,
+  //and the objects stuck in a node come before its children, they are large and good occluders
+  //back_to_front reverses all of it, for transparent objects
+  void get_culled_objects( std::vector<t>& objs, shape* f, const mm::vec3& view_dir, bool back_to_front = false, octree_query_stats* qs = 0 )
   {
     assert( is_setup );
 
-    for( auto& c : objs )
-    {
-      reposition_object( c.first, c.second );
-    }
+    unsigned first = ( view_dir.x < 0 ? 1 : 0 ) | ( view_dir.y < 0 ? 2 : 0 ) | ( view_dir.z < 0 ? 4 : 0 );
 
-    ( *root_ptr )->update_recursively();
+    if( back_to_front )
+      first ^= 7;
 
-    unsigned counter = 0;
-    for( int c = 0; c < 8; ++c )
-      if( is_child_active( c ) ) ++counter;
+    get_culled_objects( get_bv(), objs, f, qs, first, back_to_front );
+  }
 
-    //if the root doesn't contain any objects, and the
-    if( !( *root_ptr )->objects.size() && counter == 1 )
-    {
-      octree<t>* active_node = 0;
-      for( int c = 0; c < 8; ++c )
-        if( is_child_active( c ) )
-        {
-          active_node = children[c];
-          break;
-        }
+  //walks the subtree of this node, allocates nothing
+  octree_stats stats()
+  {
+    assert( is_setup );
 
-      if( active_node )
-      {
-        //TODO delete root node after removing from tree
-        *root_ptr = active_node;
-        ( *root_ptr )->parent = 0;
-      }
-    }
+    octree_stats s;
+    collect_stats( s, 0 );
+
+    unsigned inner_nodes = s.node_count - s.leaf_count;
+    unsigned filled_nodes = s.node_count - s.empty_node_count;
+    s.child_fill = inner_nodes ? s.child_fill / inner_nodes : 0;
+    s.object_fill = filled_nodes ? float( s.object_count ) / filled_nodes : 0;
+
+    s.allocated_nodes = allocated_nodes;
+    s.allocated_bytes = allocated_nodes * sizeof( octree<t> );
+    s.detached_nodes = allocated_nodes > s.node_count ? allocated_nodes - s.node_count : 0;
+
+    return s;
   }
 
-  bool remove( const t& o )
+  //trigger volumes report the objects that enter, stay in or leave them after each update, see get_trigger_events
+  //triggers are ids of the same type as the objects, but they are kept in a tree of their own, so queries never return them
+  //the volume has to stay valid while the trigger is in the tree, like the bounds of objects
+  void insert_trigger( const t& trigger, shape* volume )
   {
     assert( is_setup );
 
-    for( auto i = objects.begin(); i != objects.end(); ++i )
-      if( *i == o )
-      {
-        objects.erase( i );
-        return true;
-      }
-
-    //not found try children
-    for( int c = 0; c < 8; ++c )
+    if( !state->trigger_root )
     {
-      if( active_children & ( 1 << c ) )
-        if( children[c]->remove( o ) ) //when the object is removed we don't need to check further
-        return true;
+      state->trigger_root = new octree<t>( state->root_bv );
+      state->trigger_root->set_up_octree( &state->trigger_root );
+
+      //objects already in the tree are tested against the first triggers
+      for( auto& e : state->index )
+        state->trigger_checks.push_back( e.first );
     }
 
-    return false;
+    state->trigger_root->insert( trigger, volume );
+    state->changed_triggers.push_back( trigger );
   }
 
-  bool is_in_frustum( const t& o, shape* f )
+  //the volume may have changed in place, or be a new one
+  void reposition_trigger( const t& trigger, shape* volume )
   {
     assert( is_setup );
 
-    for( auto& c : objects )
-      if( c == o ) //is this the droid you're looking for?
-      {
-        return true; //found the object
-        /*
-        if((&bv)->intersects(f)) //is it in yet?
-        return 1; //in
-        else
-        return 0; //culled
-        */
-      }
-
-    for( int c = 0; c < 8; ++c )
-      if( is_child_active( c ) && ( &children[c]->bv )->is_intersecting( f ) )
-      if( children[c]->is_in_frustum( o, f ) )
-      return true;
+    if( !state->trigger_root )
+      return;
 
-    return false;
+    state->trigger_root->reposition_object( trigger, volume );
+    state->changed_triggers.push_back( trigger );
   }
 
-  void get_culled_objects( std::vector<t>& objs, shape* f )
+  //objects inside the trigger get exit events at the next update
+  bool remove_trigger( const t& trigger )
   {
     assert( is_setup );
 
-    if( bv.is_intersecting( f ) )
+    if( !state->trigger_root || !state->trigger_root->remove( trigger ) )
+      return false;
+
+    auto objs = state->trigger_objects.find( trigger );
+    if( objs != state->trigger_objects.end() )
     {
-      for( auto& c : objects )
+      for( auto& o : objs->second )
       {
-        objs.push_back( c );
+        push_trigger_event( state->pending_trigger_events, trigger, o, octree_trigger_event<t>::exit );
+        erase_trigger_contact( state, trigger, o );
       }
 
-      for( int c = 0; c < 8; ++c )
-        if( is_child_active( c ) )
-        children[c]->get_culled_objects( objs, f );
+      state->trigger_objects.erase( objs );
     }
+
+    return true;
+  }
+
+  //the events of the last update, for the objects and triggers that were inserted, moved or removed before it
+  const std::vector<octree_trigger_event<t> >& get_trigger_events() const
+  {
+    assert( is_setup );
+
+    return state->trigger_events;
+  }
+
+  //bounds of the nodes that intersect f, and whose objects were inserted, removed or moved since the tree had version since
+  //subtrees that didn't change are skipped, see get_version
+  //nodes that were freed since then are covered by their parent
+  void get_changed_nodes( std::vector<aabb>& boxes, shape* f, unsigned since, octree_query_stats* qs = 0 )
+  {
+    assert( is_setup );
+
+    if( epoch > since )
+      get_changed_nodes( get_bv(), boxes, f, since, qs );
   }
 
   void get_boxes( std::vector<aabb>& boxes )
   {
     assert( is_setup );
 
-    boxes.push_back( bv );
+    get_boxes( get_bv(), boxes );
+  }
 
-    for( int c = 0; c < 8; ++c )
+  //writes the subtree of this node into a snapshot that octree_snapshot<t> can map
+  //objects are copied bytewise, so t has to be trivially copyable
+  bool save( const std::string& path )
+  {
+    assert( is_setup );
+    static_assert( std::is_trivially_copyable<t>::value, "octree snapshots need a trivially copyable object type" );
+
+    std::vector<octree<t>*> order;
+    std::vector<octree_file::node> nodes;
+    uint64_t object_count = 0;
+    flatten( order, nodes, object_count );
+
+    octree_file::header head = {};
+    head.magic = octree_file::magic;
+    head.version = octree_file::version;
+    head.object_size = sizeof( t );
+    head.node_count = unsigned( nodes.size() );
+    head.object_count = object_count;
+    head.node_offset = octree_file::align( sizeof( octree_file::header ) );
+    head.object_offset = octree_file::align( head.node_offset + nodes.size() * sizeof( octree_file::node ) );
+    head.file_size = head.object_offset + object_count * sizeof( t );
+
+    std::ofstream f( path.c_str(), std::ios::binary | std::ios::trunc );
+    if( !f )
+      return false;
+
+    f.write( ( const char* )&head, sizeof( head ) );
+    write_padding( f, head.node_offset - sizeof( head ) );
+    f.write( ( const char* )nodes.data(), nodes.size() * sizeof( octree_file::node ) );
+    write_padding( f, head.object_offset - ( head.node_offset + nodes.size() * sizeof( octree_file::node ) ) );
+    write_objects( f, order, nodes );
+
+    return bool( f );
+  }
+
+  //writes the subtree of this node for paged_octree<t>
+  //nodes above page_depth stay resident, every subtree rooted at page_depth
+  //is stored in a run of page_size sized pages that is loaded on demand
+  bool save_paged( const std::string& path, unsigned page_depth, unsigned page_size = 64 * 1024 )
+  {
+    assert( is_setup );
+    assert( page_size >= octree_file::section_alignment );
+    static_assert( std::is_trivially_copyable<t>::value, "octree snapshots need a trivially copyable object type" );
+
+    std::vector<octree<t>*> order, paged_roots;
+    std::vector<octree_file::node> nodes;
+    uint64_t object_count = 0;
+    flatten( order, nodes, object_count, page_depth, &paged_roots );
+
+    octree_file::paged_header head = {};
+    head.magic = octree_file::paged_magic;
+    head.version = octree_file::version;
+    head.object_size = sizeof( t );
+    head.page_size = page_size;
+    head.page_depth = page_depth;
+    head.node_count = unsigned( nodes.size() );
+    head.object_count = object_count;
+    head.run_count = unsigned( paged_roots.size() );
+    head.node_offset = octree_file::align( sizeof( octree_file::paged_header ) );
+    head.object_offset = octree_file::align( head.node_offset + nodes.size() * sizeof( octree_file::node ) );
+    head.run_offset = octree_file::align( head.object_offset + object_count * sizeof( t ) );
+    head.page_offset = ( head.run_offset + paged_roots.size() * sizeof( octree_file::page_run ) + page_size - 1 ) / page_size * page_size;
+
+    std::ofstream f( path.c_str(), std::ios::binary | std::ios::trunc );
+    if( !f )
+      return false;
+
+    f.write( ( const char* )&head, sizeof( head ) );
+    write_padding( f, head.node_offset - sizeof( head ) );
+    f.write( ( const char* )nodes.data(), nodes.size() * sizeof( octree_file::node ) );
+    write_padding( f, head.object_offset - ( head.node_offset + nodes.size() * sizeof( octree_file::node ) ) );
+    write_objects( f, order, nodes );
+    write_padding( f, head.run_offset - ( head.object_offset + object_count * sizeof( t ) ) );
+
+    //the run table is written once the page layout is known
+    std::vector<octree_file::page_run> runs( paged_roots.size() );
+    write_padding( f, head.page_offset - head.run_offset );
+
+    uint64_t page = 0;
+    for( size_t r = 0; r < paged_roots.size(); ++r )
     {
-      if( is_child_active( c ) )
-      {
-        children[c]->get_boxes( boxes );
-      }
+      std::vector<octree<t>*> sub_order;
+      std::vector<octree_file::node> sub_nodes;
+      uint64_t sub_object_count = 0;
+      paged_roots[r]->flatten( sub_order, sub_nodes, sub_object_count );
+
+      octree_file::header sub = {};
+      sub.magic = octree_file::magic;
+      sub.version = octree_file::version;
+      sub.object_size = sizeof( t );
+      sub.node_count = unsigned( sub_nodes.size() );
+      sub.object_count = sub_object_count;
+      sub.node_offset = octree_file::align( sizeof( octree_file::header ) );
+      sub.object_offset = octree_file::align( sub.node_offset + sub_nodes.size() * sizeof( octree_file::node ) );
+      sub.file_size = sub.object_offset + sub_object_count * sizeof( t );
+
+      runs[r].first_page = page;
+      runs[r].page_count = unsigned( ( sub.file_size + page_size - 1 ) / page_size );
+      runs[r].size = sub.file_size;
+      page += runs[r].page_count;
+
+      f.write( ( const char* )&sub, sizeof( sub ) );
+      write_padding( f, sub.node_offset - sizeof( sub ) );
+      f.write( ( const char* )sub_nodes.data(), sub_nodes.size() * sizeof( octree_file::node ) );
+      write_padding( f, sub.object_offset - ( sub.node_offset + sub_nodes.size() * sizeof( octree_file::node ) ) );
+      write_objects( f, sub_order, sub_nodes );
+      write_padding( f, uint64_t( runs[r].page_count ) * page_size - sub.file_size );
     }
+
+    head.page_count = page;
+
+    f.seekp( 0 );
+    f.write( ( const char* )&head, sizeof( head ) );
+    f.seekp( head.run_offset );
+    f.write( ( const char* )runs.data(), runs.size() * sizeof( octree_file::page_run ) );
+
+    return bool( f );
   }
 
-  void insert( const t& o, shape* obv )
+  //nodes keep the bounds of their objects quantized to 16 bits relative to their cell,
+  //and partially visible nodes test their objects one by one instead of returning all of them
+  //costs 12 bytes per object
+  bool set_object_bounds( bool enabled )
   {
     assert( is_setup );
 
-    //check if shape fits, if not the octree should be extended
-    if( obv->is_inside( &bv ) )
-    {
-      //min node size is 1, so if the object fits, and the node has the minimum size, then insert here, and return
-      //no further subdividing is allowed
-      //also if the node contains less than 3 objects than insert here
-      //no further subdividing is required
-      if( bv.get_extents().x * 2 <= 1 || objects.size() < 3 )
-      {
-        objects.push_back( o );
-        vector<t>(objects).swap(objects); //trim the fat
-        return;
-      }
+    if( !state->index.empty() )
+      return false;
 
-      //build bvs of the octants
-      mm::vec3 subsize = bv.get_extents() / 2;
-      mm::vec3 basepos = bv.min + subsize;
+    state->settings.object_bounds = enabled;
+    return true;
+  }
 
-      aabb children_bv[8];
-      children_bv[0] = is_child_active( 0 ) ? children[0]->bv : aabb( basepos + mm::vec3( 0 ), subsize ); //left-bottom-front
-      children_bv[1] = is_child_active( 1 ) ? children[1]->bv : aabb( basepos + mm::vec3( bv.get_extents().x, 0, 0 ), subsize ); //right-bottom-front
-      children_bv[2] = is_child_active( 2 ) ? children[2]->bv : aabb( basepos + mm::vec3( 0, bv.get_extents().y, 0 ), subsize ); //left-top-front
-      children_bv[3] = is_child_active( 3 ) ? children[3]->bv : aabb( basepos + mm::vec3( bv.get_extents().xy, 0 ), subsize ); //right-top-front
+  //nodes keep the bounds of everything in their subtree, quantized to 16 bits relative to their cell,
+  //and queries reject nodes by them instead of their cell
+  //changes only mark the path to the root, which update refits, until then those nodes fall back to their cell
+  bool set_tight_bounds( bool enabled )
+  {
+    assert( is_setup );
 
-      children_bv[4] = is_child_active( 4 ) ? children[4]->bv : aabb( basepos + mm::vec3( 0, 0, bv.get_extents().z ), subsize ); //left-bottom-back
-      children_bv[5] = is_child_active( 5 ) ? children[5]->bv : aabb( basepos + mm::vec3( bv.get_extents().x, 0, bv.get_extents().z ), subsize ); //right-bottom-back
-      children_bv[6] = is_child_active( 6 ) ? children[6]->bv : aabb( basepos + mm::vec3( 0, bv.get_extents().y, bv.get_extents().z ), subsize ); //left-top-back
-      children_bv[7] = is_child_active( 7 ) ? children[7]->bv : aabb( basepos + mm::vec3( bv.get_extents().xy, bv.get_extents().z ), subsize ); //right-top-back
+    if( !state->index.empty() )
+      return false;
 
-      bool found = false;
-      for( int c = 0; c < 8; ++c )
-      {
-        //try to fit the object into one of the octants
-        if( obv->is_inside( &children_bv[c] ) )
-        {
-          if( !is_child_active( c ) )
-          {
-            children[c] = new octree<t>( children_bv[c] );
+    state->settings.tight_bounds = enabled;
+    return true;
+  }
 
-            children[c]->parent = this;
-            active_children |= ( 1 << c ); //activate this node
-          }
+  const octree_settings& get_settings() const
+  {
+    assert( is_setup );
 
-          //this will make sure we're inserting into the smallest possible octant down the tree
-          children[c]->insert( o, obv ); //insert into child node (recursively)
+    return state->settings;
+  }
 
-          found = true;
-        }
-      }
+  //static objects are kept in separate lists, so moving objects never touch them
+  //they can still be moved, but aren't placed by enlarged bounds
+  void insert( const t& o, shape* obv, bool is_static = false )
+  {
+    assert( is_setup );
 
-      if( !found ) //didn't fit into any subnode
-      {
-        objects.push_back( o );
-        vector<t>( objects ).swap( objects ); //trim the fat
-      }
-    }
-    else
+    if( state->trigger_root )
+      state->trigger_checks.push_back( o );
+
+    object_entry& e = state->index[o];
+    e.is_static = is_static;
+
+    if( is_static || !is_fat_enabled() )
     {
-      if( is_root() )
-      {
-        ( *root_ptr )->expand_octree( obv );
-        ( *root_ptr )->insert( o, obv );
-      }
-      else
-        ; //not a root node, stop recursion here
+      place( o, obv, obv, get_bv() );
+      return;
     }
+
+    aabb fat = get_fat_bounds( obv, get_velocity( o ) );
+
+    if( !state->settings.object_bounds )
+      state->fat[o] = pack( fat );
+
+    place( o, obv, &fat, get_bv() );
   }
 
-  void set_up_octree( octree** o )
+  //every tree that's set up gets its own bookkeeping and settings, so any number of trees of the same type can coexist
+  void set_up_octree( octree** o, const octree_settings& settings = octree_settings() )
   {
-    root_ptr = o;
+    if( !state )
+      state = new tree_state;
+
+    assert( state->index.empty() );
+
+    state->root_ptr = o;
+    state->settings = settings;
     is_setup = true;
   }
 
-  octree( const aabb& bbvv ) : active_children( 0 ), parent( 0 ), bv( bbvv ), life( -1 ), max_lifespan( 8 )
+  //frees every node of a tree that was set up with set_up_octree, and its bookkeeping
+  static void destroy( octree** o )
+  {
+    assert( is_setup );
+
+    octree<t>* root = *o;
+    tree_state* s = root->state;
+
+    //roots that were cut off but are still queued are only reachable from here
+    for( auto& n : s->aging )
+      if( !n->parent && n != root )
+        delete n;
+
+    if( s->trigger_root )
+      destroy( &s->trigger_root );
+
+    root->delete_subtree();
+    delete s;
+    *o = 0;
+  }
+
+  //sizes an empty root to the power of two cube that encloses the world up front,
+  //so that nothing inside it ever has to expand the tree, and update never collapses the root below it
+  void set_world_bounds( const aabb& world )
+  {
+    assert( is_setup );
+    assert( is_root() && !has_children() && !get_object_count() );
+
+    mm::vec3 size = world.max - world.min;
+    float edge = 1;
+
+    while( edge < size.x || edge < size.y || edge < size.z )
+      edge *= 2;
+
+    state->root_bv.min = world.min;
+    state->root_bv.max = world.min + mm::vec3( edge );
+    state->world_bv = state->root_bv;
+    state->has_world_bounds = true;
+  }
+
+  //the bounds of a root are kept in the bookkeeping of its tree, so it gets one right away
+  octree( const aabb& bbvv ) : state( new tree_state ), children( 0 ), parent( 0 ), nb( 0 ), life( -1 ), subtree_count( 0 ), max_lifespan( 8 ), epoch( 0 ), own_epoch( 0 ), active_children( 0 ), is_aging( false ), octant( 0 )
   {
-    children.resize(8);
+    state->root_bv = bbvv;
+    ++allocated_nodes;
   }
 
-  octree() : active_children( 0 ), parent( 0 ), life( -1 ), max_lifespan( 8 )
+  octree() : state( 0 ), children( 0 ), parent( 0 ), nb( 0 ), life( -1 ), subtree_count( 0 ), max_lifespan( 8 ), epoch( 0 ), own_epoch( 0 ), active_children( 0 ), is_aging( false ), octant( 0 )
   {
-    children.resize( 8 );
+    ++allocated_nodes;
+  }
+
+  ~octree()
+  {
+    delete[] children;
+    delete nb;
+    --allocated_nodes;
   }
 
 #if USE_MYMATH_ALLOCATOR == 1
@@ -481,7 +2863,7 @@ public:
 #ifdef _WIN32
     _aligned_free( m );
 #else
-    free( p );
+    free( m );
 #endif
   }
 #endif
@@ -491,7 +2873,8 @@ template< class t >
 const mm::vec3 octree<t>::min_bv_size = 1;
 
 template< class t >
-octree<t>** octree<t>::root_ptr = 0;
+std::atomic<unsigned> octree<t>::allocated_nodes( 0 );
+
 
 template< class t >
 const int octree<t>::max_life_boundary = 64;
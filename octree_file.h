@@ -0,0 +1,138 @@
+#ifndef octree_file_h
+#define octree_file_h
+
+#include <stdint.h>
+
+//on-disk layout of an octree snapshot
+//nodes and objects are addressed by index and the sections by byte offset,
+//so the file is relocatable and can be mapped anywhere in memory
+namespace octree_file
+{
+  static const uint32_t magic = 0x5254434f; //"OCTR" in little endian
+  static const uint32_t version = 1;
+
+  //sections are aligned to this so that they can be used in place
+  static const uint64_t section_alignment = 16;
+
+  struct header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t object_size; //sizeof(t) the snapshot was written with
+    uint32_t node_count;
+    uint64_t object_count;
+    uint64_t node_offset; //byte offset of the node array from the start of the file
+    uint64_t object_offset; //byte offset of the object array from the start of the file
+    uint64_t file_size;
+  };
+
+  //nodes are stored breadth first, so the active children of a node are contiguous
+  //the c-th child is at first_child + popcount(active_children & ((1 << c) - 1))
+  struct node
+  {
+    float min[3], max[3]; //bounding volume of the node
+    uint32_t first_child;
+    uint32_t object_count;
+    uint64_t first_object;
+    uint8_t active_children; //bitmask, same octant order as octree<t>
+    uint8_t flags;
+    uint8_t pad[6];
+  };
+
+  enum node_flags
+  {
+    PAGED = 1 //the subtree of the node lives in a page run, first_child is the index of that run
+  };
+
+  static uint64_t align( uint64_t offset )
+  {
+    return ( offset + section_alignment - 1 ) & ~( section_alignment - 1 );
+  }
+
+  //checks every child and object index against the section counts, so that a corrupt file can't make a query read out of bounds
+  //children are stored after their parent, which also rules out loops
+  //paged nodes point to a page run instead of their children, plain snapshots have no runs
+  static bool are_nodes_valid( const node* nodes, uint32_t node_count, uint64_t object_count, uint32_t run_count )
+  {
+    for( uint32_t n = 0; n < node_count; ++n )
+    {
+      const node& nd = nodes[n];
+
+      if( nd.first_object > object_count || nd.object_count > object_count - nd.first_object )
+        return false;
+
+      if( nd.flags & PAGED )
+      {
+        if( nd.first_child >= run_count )
+          return false;
+
+        continue;
+      }
+
+      unsigned children = 0;
+      for( int c = 0; c < 8; ++c )
+        if( nd.active_children & ( 1 << c ) )
+          ++children;
+
+      if( children && ( nd.first_child <= n || nd.first_child > node_count - children ) )
+        return false;
+    }
+
+    return true;
+  }
+
+  //checks the header, the sections and the nodes of a snapshot of size bytes
+  template< class t >
+  static bool is_snapshot_valid( const char* data, uint64_t size )
+  {
+    if( size < sizeof( header ) )
+      return false;
+
+    const header* head = ( const header* )data;
+
+    if( head->magic != magic || head->version != version ||
+      head->object_size != sizeof( t ) || head->file_size != size || !head->node_count )
+      return false;
+
+    if( head->node_offset > size || uint64_t( head->node_count ) * sizeof( node ) > size - head->node_offset )
+      return false;
+
+    if( head->object_offset > size || head->object_count > ( size - head->object_offset ) / sizeof( t ) )
+      return false;
+
+    return are_nodes_valid( ( const node* )( data + head->node_offset ), head->node_count, head->object_count, 0 );
+  }
+
+  //on-disk layout of a paged octree
+  //the top of the tree is stored like a snapshot, nodes flagged PAGED point to a page run
+  //every page run holds a complete snapshot (header, nodes, objects) of one subtree
+  static const uint32_t paged_magic = 0x5054434f; //"OCTP" in little endian
+
+  struct paged_header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t object_size; //sizeof(t) the file was written with
+    uint32_t page_size;
+    uint32_t page_depth; //depth of the subtree roots that live in pages
+    uint32_t node_count; //resident nodes
+    uint32_t run_count;
+    uint32_t pad;
+    uint64_t object_count; //resident objects
+    uint64_t page_count;
+    uint64_t node_offset;
+    uint64_t object_offset;
+    uint64_t run_offset;
+    uint64_t page_offset; //byte offset of the first page, page aligned
+  };
+
+  struct page_run
+  {
+    uint64_t first_page;
+    uint64_t size; //bytes used in the run, the rest of the last page is padding
+    uint32_t page_count;
+    uint32_t pad;
+  };
+}
+
+#endif
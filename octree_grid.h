@@ -0,0 +1,398 @@
+#ifndef octree_grid_h
+#define octree_grid_h
+
+#include "octree.h"
+#include <unordered_map>
+#include <vector>
+#include <cmath>
+
+//integer coordinates of a sector, the sector covers [coord * size, (coord + 1) * size)
+struct sector_coord
+{
+  int x, y, z;
+
+  bool operator==( const sector_coord& other ) const
+  {
+    return x == other.x && y == other.y && z == other.z;
+  }
+
+  bool operator!=( const sector_coord& other ) const
+  {
+    return !( *this == other );
+  }
+};
+
+struct sector_coord_hash
+{
+  size_t operator()( const sector_coord& c ) const
+  {
+    //unsigned, so the products wrap instead of overflowing
+    return size_t( uint32_t( c.x ) * 73856093u ^ uint32_t( c.y ) * 19349663u ^ uint32_t( c.z ) * 83492791u );
+  }
+};
+
+//hashed grid of fixed size sectors above octree<t>, for worlds without bounds
+//every sector owns its own octree, so sectors can be built, updated and unloaded independently
+//sectors are created by the first object that arrives and freed once the last one leaves
+//insert, remove and mark_dirty change the grid and have to be called from one thread,
+//but update_sector can be called for different sectors from different threads at the same time
+//positions stay in the absolute float coordinates of the caller, nothing is rebased per sector,
+//so far from the origin the trees are only as precise as those floats (a step of 1/16 at a million units)
+template< class t >
+class octree_grid
+{
+  struct object_entry
+  {
+    sector_coord sector;
+    shape* bv;
+    bool is_static;
+  };
+
+  struct sector
+  {
+    octree<t>* root;
+    unsigned object_count;
+  };
+
+  float sector_size;
+  float max_extent; //largest half size of any object so far, how far objects can stick out of their sector
+  octree_settings settings; //of every sector
+  std::unordered_map<sector_coord, sector, sector_coord_hash> sectors; //the map owns the root pointers the trees expand through
+  std::unordered_map<t, object_entry> index; //sector of each object
+
+  //objects belong to the sector their center is in, and may stick out of it
+  sector_coord get_coord( shape* obv ) const
+  {
+    mm::vec3 center;
+
+    if( obv->get_class_index() == sphere::get_class_idx() )
+      center = static_cast<sphere*>( obv )->get_center();
+    else
+    {
+      assert( obv->get_class_index() == aabb::get_class_idx() );
+      center = static_cast<aabb*>( obv )->get_pos();
+    }
+
+    sector_coord c;
+    c.x = int( std::floor( center.x / sector_size ) );
+    c.y = int( std::floor( center.y / sector_size ) );
+    c.z = int( std::floor( center.z / sector_size ) );
+    return c;
+  }
+
+  void grow_max_extent( shape* obv )
+  {
+    mm::vec3 half;
+
+    if( obv->get_class_index() == sphere::get_class_idx() )
+      half = mm::vec3( static_cast<sphere*>( obv )->get_radius() );
+    else
+    {
+      assert( obv->get_class_index() == aabb::get_class_idx() );
+      half = static_cast<aabb*>( obv )->get_extents();
+    }
+
+    max_extent = std::max( max_extent, std::max( half.x, std::max( half.y, half.z ) ) );
+  }
+
+  //axis aligned box around a query shape, returns false for shapes without bounds
+  static bool get_query_bounds( shape* f, aabb& b )
+  {
+    if( f->get_class_index() == aabb::get_class_idx() )
+      b = *static_cast<aabb*>( f );
+    else if( f->get_class_index() == sphere::get_class_idx() )
+    {
+      sphere* s = static_cast<sphere*>( f );
+      b = aabb( s->get_center(), mm::vec3( s->get_radius() ) );
+    }
+    else if( f->get_class_index() == frustum::get_class_idx() )
+    {
+      frustum* fr = static_cast<frustum*>( f );
+      b.min = b.max = fr->points[0];
+
+      for( int c = 1; c < 8; ++c )
+        b.expand( fr->points[c] );
+    }
+    else
+      return false;
+
+    return true;
+  }
+
+  static int to_coord( float v )
+  {
+    //far planes can be huge, and a range that wide is walked through the sector map anyway
+    return int( std::max( -1e9f, std::min( 1e9f, std::floor( v ) ) ) );
+  }
+
+  //sectors whose objects can overlap the query, the objects of a sector are within max_extent of it
+  //returns false if every sector has to be visited
+  bool get_sector_range( shape* f, sector_coord& lo, sector_coord& hi ) const
+  {
+    aabb b;
+    if( !get_query_bounds( f, b ) )
+      return false;
+
+    lo.x = to_coord( ( b.min.x - max_extent ) / sector_size );
+    lo.y = to_coord( ( b.min.y - max_extent ) / sector_size );
+    lo.z = to_coord( ( b.min.z - max_extent ) / sector_size );
+    hi.x = to_coord( ( b.max.x + max_extent ) / sector_size );
+    hi.y = to_coord( ( b.max.y + max_extent ) / sector_size );
+    hi.z = to_coord( ( b.max.z + max_extent ) / sector_size );
+
+    return true;
+  }
+
+  static bool is_in_range( const sector_coord& c, const sector_coord& lo, const sector_coord& hi )
+  {
+    return c.x >= lo.x && c.x <= hi.x && c.y >= lo.y && c.y <= hi.y && c.z >= lo.z && c.z <= hi.z;
+  }
+
+  sector& get_sector( const sector_coord& c )
+  {
+    auto it = sectors.find( c );
+    if( it != sectors.end() )
+      return it->second;
+
+    aabb world;
+    world.min = mm::vec3( float( c.x ), float( c.y ), float( c.z ) ) * sector_size;
+    world.max = world.min + mm::vec3( sector_size );
+
+    sector& s = sectors[c];
+    s.root = new octree<t>( world );
+    s.root->set_up_octree( &s.root, settings );
+    s.root->set_world_bounds( world );
+    s.object_count = 0;
+
+    return s;
+  }
+
+  void insert_into( const sector_coord& c, const t& o, shape* obv, bool is_static )
+  {
+    sector& s = get_sector( c );
+    s.root->insert( o, obv, is_static );
+    ++s.object_count;
+  }
+
+  //frees the sector once its last object is gone
+  void remove_from( const sector_coord& c, const t& o )
+  {
+    auto it = sectors.find( c );
+    if( it == sectors.end() )
+      return;
+
+    it->second.root->remove( o );
+
+    if( !--it->second.object_count )
+    {
+      octree<t>::destroy( &it->second.root );
+      sectors.erase( it );
+    }
+  }
+
+  //no copies, the sectors are owned
+  octree_grid( const octree_grid& );
+  octree_grid& operator=( const octree_grid& );
+public:
+
+  void insert( const t& o, shape* obv, bool is_static = false )
+  {
+    object_entry e;
+    e.sector = get_coord( obv );
+    e.bv = obv;
+    e.is_static = is_static;
+
+    grow_max_extent( obv );
+    insert_into( e.sector, o, obv, is_static );
+    index[o] = e;
+  }
+
+  bool remove( const t& o )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return false;
+
+    remove_from( it->second.sector, o );
+    index.erase( it );
+
+    return true;
+  }
+
+  //objects that moved into another sector are handed over right away,
+  //the rest is repositioned by the next update of their sector
+  void mark_dirty( const t& o )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return;
+
+    object_entry& e = it->second;
+    sector_coord c = get_coord( e.bv );
+
+    grow_max_extent( e.bv );
+
+    if( c != e.sector )
+    {
+      remove_from( e.sector, o );
+      insert_into( c, o, e.bv, e.is_static );
+      e.sector = c;
+    }
+    else
+      sectors[c].root->mark_dirty( o, e.bv );
+  }
+
+  void mark_dirty( const t& o, shape* obv )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return;
+
+    it->second.bv = obv;
+    mark_dirty( o );
+  }
+
+  octree_update_stats update_sector( const sector_coord& c, unsigned max_nodes = ~0u, float max_ms = 0 )
+  {
+    auto it = sectors.find( c );
+    if( it == sectors.end() )
+      return octree_update_stats();
+
+    return it->second.root->update( max_nodes, max_ms );
+  }
+
+  octree_update_stats update( unsigned max_nodes = ~0u, float max_ms = 0 )
+  {
+    octree_update_stats us;
+
+    for( auto& s : sectors )
+    {
+      octree_update_stats ss = s.second.root->update( max_nodes, max_ms );
+      us.repositioned += ss.repositioned;
+      us.reinserted += ss.reinserted;
+      us.nodes_aged += ss.nodes_aged;
+      us.nodes_freed += ss.nodes_freed;
+      us.merges += ss.merges;
+      us.nodes_pending += ss.nodes_pending;
+    }
+
+    return us;
+  }
+
+  //frees the octree of a sector, and forgets the objects that were in it
+  //returns the number of objects dropped
+  unsigned unload( const sector_coord& c )
+  {
+    auto it = sectors.find( c );
+    if( it == sectors.end() )
+      return 0;
+
+    octree<t>::destroy( &it->second.root );
+    sectors.erase( it );
+
+    unsigned dropped = 0;
+    for( auto i = index.begin(); i != index.end(); )
+      if( i->second.sector == c )
+      {
+        i = index.erase( i );
+        ++dropped;
+      }
+      else
+        ++i;
+
+    return dropped;
+  }
+
+  void unload()
+  {
+    for( auto& s : sectors )
+      octree<t>::destroy( &s.second.root );
+
+    sectors.clear();
+    index.clear();
+  }
+
+  void get_sectors( std::vector<sector_coord>& coords ) const
+  {
+    for( auto& s : sectors )
+      coords.push_back( s.first );
+  }
+
+  unsigned get_sector_count() const
+  {
+    return unsigned( sectors.size() );
+  }
+
+  float get_sector_size() const
+  {
+    return sector_size;
+  }
+
+  //only the sectors in the range of the query's bounds are visited, shapes without bounds visit all of them
+  //a small range looks its sectors up, a range with more cells than there are sectors filters the sector map
+  void get_culled_objects( std::vector<t>& objs, shape* f, octree_query_stats* qs = 0 )
+  {
+    sector_coord lo, hi;
+
+    if( !get_sector_range( f, lo, hi ) )
+    {
+      for( auto& s : sectors )
+        s.second.root->get_culled_objects( objs, f, qs );
+
+      return;
+    }
+
+    double cells = ( double( hi.x ) - lo.x + 1 ) * ( double( hi.y ) - lo.y + 1 ) * ( double( hi.z ) - lo.z + 1 );
+
+    if( cells > double( sectors.size() ) )
+    {
+      for( auto& s : sectors )
+        if( is_in_range( s.first, lo, hi ) )
+          s.second.root->get_culled_objects( objs, f, qs );
+
+      return;
+    }
+
+    sector_coord c;
+    for( c.z = lo.z; c.z <= hi.z; ++c.z )
+      for( c.y = lo.y; c.y <= hi.y; ++c.y )
+        for( c.x = lo.x; c.x <= hi.x; ++c.x )
+        {
+          auto it = sectors.find( c );
+          if( it != sectors.end() )
+            it->second.root->get_culled_objects( objs, f, qs );
+        }
+  }
+
+  //agrees with get_culled_objects, sectors out of the range of the query are rejected the same way
+  bool is_in_frustum( const t& o, shape* f, octree_query_stats* qs = 0 )
+  {
+    auto it = index.find( o );
+    if( it == index.end() )
+      return false;
+
+    sector_coord lo, hi;
+    if( get_sector_range( f, lo, hi ) && !is_in_range( it->second.sector, lo, hi ) )
+      return false;
+
+    return sectors[it->second.sector].root->is_in_frustum( o, f, qs );
+  }
+
+  void get_boxes( std::vector<aabb>& boxes )
+  {
+    for( auto& s : sectors )
+      s.second.root->get_boxes( boxes );
+  }
+
+  octree_grid( float size = 256, const octree_settings& s = octree_settings() ) : sector_size( size ), max_extent( 0 ), settings( s )
+  {
+    assert( sector_size > 0 );
+  }
+
+  ~octree_grid()
+  {
+    unload();
+  }
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef octree_snapshot_h
+#define octree_snapshot_h
+
+#ifdef _WIN32
+//the min and max macros would break std::min, std::max and std::numeric_limits in everything included after this
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "octree.h"
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+//read-only view of a snapshot written by octree<t>::save
+//the file is memory mapped and queried in place, nothing is deserialised
+template< class t >
+class octree_snapshot
+{
+  const char* data;
+  uint64_t size;
+
+  const octree_file::header* head;
+  const octree_file::node* nodes;
+  const t* objects;
+
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int file;
+#endif
+
+  aabb get_bv( const octree_file::node& n ) const
+  {
+    aabb bv;
+    bv.min = mm::vec3( n.min[0], n.min[1], n.min[2] );
+    bv.max = mm::vec3( n.max[0], n.max[1], n.max[2] );
+    return bv;
+  }
+
+  bool is_valid() const
+  {
+    return octree_file::is_snapshot_valid<t>( data, size );
+  }
+
+  void get_culled_objects( unsigned n, std::vector<t>& objs, shape* f ) const
+  {
+    const octree_file::node& nd = nodes[n];
+    aabb bv = get_bv( nd );
+
+    if( bv.is_intersecting( f ) )
+    {
+      objs.insert( objs.end(), objects + nd.first_object, objects + nd.first_object + nd.object_count );
+
+      unsigned child = nd.first_child;
+      for( int c = 0; c < 8; ++c )
+        if( nd.active_children & ( 1 << c ) )
+          get_culled_objects( child++, objs, f );
+    }
+  }
+
+  void get_visibility( unsigned n, std::vector<bool>& visible, shape* f ) const
+  {
+    const octree_file::node& nd = nodes[n];
+    aabb bv = get_bv( nd );
+
+    if( bv.is_intersecting( f ) )
+    {
+      for( uint64_t c = 0; c < nd.object_count; ++c )
+      {
+        size_t o = size_t( objects[nd.first_object + c] );
+
+        if( o >= visible.size() )
+          visible.resize( o + 1, false );
+
+        visible[o] = true;
+      }
+
+      unsigned child = nd.first_child;
+      for( int c = 0; c < 8; ++c )
+        if( nd.active_children & ( 1 << c ) )
+          get_visibility( child++, visible, f );
+    }
+  }
+
+  //nodes are rejected on entry, the root included, so it agrees with get_culled_objects
+  bool is_in_frustum( unsigned n, const t& o, shape* f ) const
+  {
+    const octree_file::node& nd = nodes[n];
+    aabb bv = get_bv( nd );
+
+    if( !bv.is_intersecting( f ) )
+      return false;
+
+    for( uint64_t c = 0; c < nd.object_count; ++c )
+      if( objects[nd.first_object + c] == o )
+        return true;
+
+    unsigned child = nd.first_child;
+    for( int c = 0; c < 8; ++c )
+      if( nd.active_children & ( 1 << c ) )
+        if( is_in_frustum( child++, o, f ) )
+          return true;
+
+    return false;
+  }
+
+  //no copies, the mapping is owned
+  octree_snapshot( const octree_snapshot& );
+  octree_snapshot& operator=( const octree_snapshot& );
+public:
+
+  bool load( const std::string& path )
+  {
+    unload();
+
+#ifdef _WIN32
+    file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+    if( file == INVALID_HANDLE_VALUE )
+      return false;
+
+    LARGE_INTEGER file_size;
+    if( !GetFileSizeEx( file, &file_size ) || !file_size.QuadPart )
+    {
+      unload();
+      return false;
+    }
+
+    size = file_size.QuadPart;
+
+    mapping = CreateFileMappingA( file, 0, PAGE_READONLY, 0, 0, 0 );
+    if( !mapping )
+    {
+      unload();
+      return false;
+    }
+
+    data = ( const char* )MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+    file = open( path.c_str(), O_RDONLY );
+    if( file < 0 )
+      return false;
+
+    struct stat st;
+    if( fstat( file, &st ) || !st.st_size )
+    {
+      unload();
+      return false;
+    }
+
+    size = st.st_size;
+
+    void* m = mmap( 0, size, PROT_READ, MAP_SHARED, file, 0 );
+    data = m == MAP_FAILED ? 0 : ( const char* )m;
+#endif
+
+    if( !data )
+    {
+      unload();
+      return false;
+    }
+
+    head = ( const octree_file::header* )data;
+
+    if( !is_valid() )
+    {
+      unload();
+      return false;
+    }
+
+    nodes = ( const octree_file::node* )( data + head->node_offset );
+    objects = ( const t* )( data + head->object_offset );
+
+    return true;
+  }
+
+  void unload()
+  {
+#ifdef _WIN32
+    if( data )
+      UnmapViewOfFile( data );
+
+    if( mapping )
+      CloseHandle( mapping );
+
+    if( file != INVALID_HANDLE_VALUE )
+      CloseHandle( file );
+
+    file = INVALID_HANDLE_VALUE;
+    mapping = 0;
+#else
+    if( data )
+      munmap( ( void* )data, size );
+
+    if( file >= 0 )
+      close( file );
+
+    file = -1;
+#endif
+
+    data = 0;
+    size = 0;
+    head = 0;
+    nodes = 0;
+    objects = 0;
+  }
+
+  bool is_loaded() const
+  {
+    return data != 0;
+  }
+
+  unsigned get_node_count() const
+  {
+    return head ? head->node_count : 0;
+  }
+
+  uint64_t get_object_count() const
+  {
+    return head ? head->object_count : 0;
+  }
+
+  void get_culled_objects( std::vector<t>& objs, shape* f ) const
+  {
+    assert( is_loaded() );
+
+    get_culled_objects( 0, objs, f );
+  }
+
+  //sets visible[o] for every object that get_culled_objects would return, and clears the rest, in one traversal
+  //objects have to be usable as indices, visible grows to hold the largest one found
+  void get_visibility( std::vector<bool>& visible, shape* f ) const
+  {
+    assert( is_loaded() );
+    static_assert( std::is_integral<t>::value, "visibility bitsets need integral object ids" );
+
+    std::fill( visible.begin(), visible.end(), false );
+    get_visibility( 0, visible, f );
+  }
+
+  bool is_in_frustum( const t& o, shape* f ) const
+  {
+    assert( is_loaded() );
+
+    return is_in_frustum( 0, o, f );
+  }
+
+  void get_boxes( std::vector<aabb>& boxes ) const
+  {
+    assert( is_loaded() );
+
+    for( unsigned c = 0; c < head->node_count; ++c )
+      boxes.push_back( get_bv( nodes[c] ) );
+  }
+
+  octree_snapshot() : data( 0 ), size( 0 ), head( 0 ), nodes( 0 ), objects( 0 )
+  {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = 0;
+#else
+    file = -1;
+#endif
+  }
+
+  ~octree_snapshot()
+  {
+    unload();
+  }
+};
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef paged_octree_h
+#define paged_octree_h
+
+#include "octree.h"
+#include <fstream>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+
+//octree that keeps only its top levels in memory, written by octree<t>::save_paged
+//subtrees are faulted in by the queries through an lru cache that stays within a memory budget
+template< class t >
+class paged_octree
+{
+  struct page
+  {
+    std::vector<char> data; //snapshot of the subtree
+    std::list<unsigned>::iterator lru_pos;
+  };
+
+  std::ifstream file;
+  octree_file::paged_header head;
+  std::vector<octree_file::node> nodes;
+  std::vector<t> objects;
+  std::vector<octree_file::page_run> runs;
+
+  std::unordered_map<unsigned, page> resident;
+  std::list<unsigned> lru; //most recently used first
+  uint64_t memory_budget;
+  uint64_t resident_bytes;
+  unsigned faults, hits;
+  unsigned read_errors; //runs that couldn't be read or were corrupt
+
+  aabb get_bv( const octree_file::node& n ) const
+  {
+    aabb bv;
+    bv.min = mm::vec3( n.min[0], n.min[1], n.min[2] );
+    bv.max = mm::vec3( n.max[0], n.max[1], n.max[2] );
+    return bv;
+  }
+
+  void evict( uint64_t needed )
+  {
+    while( !lru.empty() && resident_bytes + needed > memory_budget )
+    {
+      auto it = resident.find( lru.back() );
+      resident_bytes -= it->second.data.size();
+      resident.erase( it );
+      lru.pop_back();
+    }
+  }
+
+  //returns the subtree snapshot of a run, reading it from the file if it's not resident
+  //returns 0 if the run can't be read, or isn't a valid snapshot
+  const octree_file::header* fault( unsigned run )
+  {
+    auto it = resident.find( run );
+
+    if( it != resident.end() )
+    {
+      lru.splice( lru.begin(), lru, it->second.lru_pos );
+      ++hits;
+      return ( const octree_file::header* )it->second.data.data();
+    }
+
+    const octree_file::page_run& r = runs[run];
+
+    //the run being faulted in is always allowed, even if it's over budget on its own
+    evict( r.size );
+
+    page& p = resident[run];
+    p.data.resize( r.size );
+
+    file.clear();
+    file.seekg( head.page_offset + r.first_page * head.page_size );
+    file.read( p.data.data(), r.size );
+
+    if( !file || !octree_file::is_snapshot_valid<t>( p.data.data(), r.size ) )
+    {
+      resident.erase( run );
+      ++read_errors;
+      return 0;
+    }
+
+    lru.push_front( run );
+    p.lru_pos = lru.begin();
+    resident_bytes += r.size;
+    ++faults;
+
+    return ( const octree_file::header* )p.data.data();
+  }
+
+  template< class func >
+  bool visit_run( unsigned run, const func& f )
+  {
+    auto sub = fault( run );
+    if( !sub )
+      return false;
+
+    auto sub_nodes = ( const octree_file::node* )( ( const char* )sub + sub->node_offset );
+    auto sub_objects = ( const t* )( ( const char* )sub + sub->object_offset );
+
+    f( sub_nodes, sub_objects );
+    return true;
+  }
+
+  //returns false if a run couldn't be read, the objects of the rest of the tree are still collected
+  bool get_culled_objects( const octree_file::node* ns, const t* os, unsigned n, std::vector<t>& objs, shape* f )
+  {
+    const octree_file::node& nd = ns[n];
+    aabb bv = get_bv( nd );
+    bool ok = true;
+
+    if( bv.is_intersecting( f ) )
+    {
+      if( nd.flags & octree_file::PAGED )
+      {
+        return visit_run( nd.first_child, [&]( const octree_file::node* sub_nodes, const t* sub_objects )
+        {
+          ok = get_culled_objects( sub_nodes, sub_objects, 0, objs, f );
+        } ) && ok;
+      }
+
+      objs.insert( objs.end(), os + nd.first_object, os + nd.first_object + nd.object_count );
+
+      unsigned child = nd.first_child;
+      for( int c = 0; c < 8; ++c )
+        if( nd.active_children & ( 1 << c ) )
+          ok = get_culled_objects( ns, os, child++, objs, f ) && ok;
+    }
+
+    return ok;
+  }
+
+  //nodes are rejected on entry, the root included, so it agrees with get_culled_objects
+  bool is_in_frustum( const octree_file::node* ns, const t* os, unsigned n, const t& o, shape* f )
+  {
+    const octree_file::node& nd = ns[n];
+    aabb bv = get_bv( nd );
+
+    if( !bv.is_intersecting( f ) )
+      return false;
+
+    if( nd.flags & octree_file::PAGED )
+    {
+      bool found = false;
+      visit_run( nd.first_child, [&]( const octree_file::node* sub_nodes, const t* sub_objects )
+      {
+        found = is_in_frustum( sub_nodes, sub_objects, 0, o, f );
+      } );
+      return found;
+    }
+
+    for( uint64_t c = 0; c < nd.object_count; ++c )
+      if( os[nd.first_object + c] == o )
+        return true;
+
+    unsigned child = nd.first_child;
+    for( int c = 0; c < 8; ++c )
+      if( nd.active_children & ( 1 << c ) )
+        if( is_in_frustum( ns, os, child++, o, f ) )
+          return true;
+
+    return false;
+  }
+
+  //no copies, the file and the cache are owned
+  paged_octree( const paged_octree& );
+  paged_octree& operator=( const paged_octree& );
+public:
+
+  bool load( const std::string& path, uint64_t budget = 64 * 1024 * 1024 )
+  {
+    unload();
+
+    file.open( path.c_str(), std::ios::binary );
+    if( !file )
+      return false;
+
+    file.seekg( 0, std::ios::end );
+    uint64_t size = uint64_t( file.tellg() );
+    file.seekg( 0 );
+
+    file.read( ( char* )&head, sizeof( head ) );
+
+    if( !file || head.magic != octree_file::paged_magic || head.version != octree_file::version ||
+      head.object_size != sizeof( t ) || !head.node_count || !head.page_size )
+    {
+      unload();
+      return false;
+    }
+
+    //the sections have to be in the file before anything is allocated for them
+    if( head.node_offset > size || uint64_t( head.node_count ) * sizeof( octree_file::node ) > size - head.node_offset ||
+      head.object_offset > size || head.object_count > ( size - head.object_offset ) / sizeof( t ) ||
+      head.run_offset > size || uint64_t( head.run_count ) * sizeof( octree_file::page_run ) > size - head.run_offset ||
+      head.page_offset > size )
+    {
+      unload();
+      return false;
+    }
+
+    nodes.resize( head.node_count );
+    objects.resize( head.object_count );
+    runs.resize( head.run_count );
+
+    file.seekg( head.node_offset );
+    file.read( ( char* )nodes.data(), nodes.size() * sizeof( octree_file::node ) );
+    file.seekg( head.object_offset );
+    file.read( ( char* )objects.data(), objects.size() * sizeof( t ) );
+    file.seekg( head.run_offset );
+    file.read( ( char* )runs.data(), runs.size() * sizeof( octree_file::page_run ) );
+
+    if( !file || !octree_file::are_nodes_valid( nodes.data(), head.node_count, head.object_count, head.run_count ) )
+    {
+      unload();
+      return false;
+    }
+
+    //the contents of the runs are checked when they are faulted in
+    uint64_t pages = ( size - head.page_offset ) / head.page_size;
+    for( auto& r : runs )
+      if( r.size < sizeof( octree_file::header ) || r.first_page > pages || r.page_count > pages - r.first_page ||
+        r.size > uint64_t( r.page_count ) * head.page_size )
+      {
+        unload();
+        return false;
+      }
+
+    memory_budget = budget;
+
+    return true;
+  }
+
+  void unload()
+  {
+    file.close();
+    file.clear();
+    nodes.clear();
+    objects.clear();
+    runs.clear();
+    resident.clear();
+    lru.clear();
+    resident_bytes = 0;
+    faults = 0;
+    hits = 0;
+    read_errors = 0;
+  }
+
+  bool is_loaded() const
+  {
+    return !nodes.empty();
+  }
+
+  void set_memory_budget( uint64_t budget )
+  {
+    memory_budget = budget;
+    evict( 0 );
+  }
+
+  uint64_t get_resident_bytes() const
+  {
+    return resident_bytes;
+  }
+
+  unsigned get_resident_runs() const
+  {
+    return unsigned( resident.size() );
+  }
+
+  unsigned get_fault_count() const
+  {
+    return faults;
+  }
+
+  unsigned get_hit_count() const
+  {
+    return hits;
+  }
+
+  unsigned get_read_error_count() const
+  {
+    return read_errors;
+  }
+
+  //faults in the subtrees the camera is looking towards, nearest first
+  //at most max_faults runs are read, so it can be called every frame
+  void prefetch( const mm::vec3& pos, const mm::vec3& view_dir, float distance, unsigned max_faults = 4 )
+  {
+    assert( is_loaded() );
+
+    mm::vec3 dir = mm::normalize( view_dir );
+    std::vector<std::pair<float, unsigned> > candidates;
+
+    for( auto& n : nodes )
+      if( ( n.flags & octree_file::PAGED ) && !resident.count( n.first_child ) )
+      {
+        //clip the view segment against the slabs of the node
+        float enter = 0, leave = distance;
+        for( int c = 0; c < 3 && enter <= leave; ++c )
+        {
+          if( std::abs( dir[c] ) < mm::epsilon )
+          {
+            if( pos[c] < n.min[c] || pos[c] > n.max[c] )
+              leave = -1;
+          }
+          else
+          {
+            float t0 = ( n.min[c] - pos[c] ) / dir[c];
+            float t1 = ( n.max[c] - pos[c] ) / dir[c];
+            enter = std::max( enter, std::min( t0, t1 ) );
+            leave = std::min( leave, std::max( t0, t1 ) );
+          }
+        }
+
+        if( enter <= leave )
+          candidates.push_back( std::make_pair( enter, n.first_child ) );
+      }
+
+    std::sort( candidates.begin(), candidates.end() );
+
+    for( unsigned c = 0; c < candidates.size() && c < max_faults; ++c )
+    {
+      //don't push out what's already needed to make room for speculative reads
+      if( resident_bytes + runs[candidates[c].second].size > memory_budget )
+        break;
+
+      fault( candidates[c].second );
+    }
+  }
+
+  //returns false if a run couldn't be read, the objects in it are missing from objs then
+  bool get_culled_objects( std::vector<t>& objs, shape* f )
+  {
+    assert( is_loaded() );
+
+    return get_culled_objects( nodes.data(), objects.data(), 0, objs, f );
+  }
+
+  //objects in runs that couldn't be read are reported as not visible, see get_read_error_count
+  bool is_in_frustum( const t& o, shape* f )
+  {
+    assert( is_loaded() );
+
+    return is_in_frustum( nodes.data(), objects.data(), 0, o, f );
+  }
+
+  //only the resident part of the tree is returned, nothing is faulted in
+  void get_boxes( std::vector<aabb>& boxes )
+  {
+    assert( is_loaded() );
+
+    for( auto& n : nodes )
+      boxes.push_back( get_bv( n ) );
+
+    for( auto& p : resident )
+    {
+      auto sub = ( const octree_file::header* )p.second.data.data();
+      auto sub_nodes = ( const octree_file::node* )( p.second.data.data() + sub->node_offset );
+
+      for( unsigned c = 0; c < sub->node_count; ++c )
+        boxes.push_back( get_bv( sub_nodes[c] ) );
+    }
+  }
+
+  paged_octree() : memory_budget( 0 ), resident_bytes( 0 ), faults( 0 ), hits( 0 ), read_errors( 0 )
+  {
+  }
+};
+
+#endif